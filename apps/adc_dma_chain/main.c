@@ -1,30 +1,18 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
-#include "hardware/dma.h"
-#include "hardware/irq.h"
+#include "dma_stream.h"
 
 #define CAPTURE_CHANNEL 4
 #define CAPTURE_DEPTH 10000
 
-uint dma_chan_a, dma_chan_b;
 uint8_t capture_buf_a[CAPTURE_DEPTH];
 uint8_t capture_buf_b[CAPTURE_DEPTH];
 
-void dma_handler(uint8_t* buffer, int id) {
-    printf("DMA IRQ %d [%d %d %d]\n", id, buffer[0], buffer[1], buffer[2]);
-}
-
-void dma_handler_a() {
-    dma_handler((uint8_t*)&capture_buf_a, 0);
-    dma_hw->ints0 = 1u << dma_chan_a;
-    dma_channel_set_write_addr(dma_chan_a, &capture_buf_a, false);
-}
+dma_stream_t stream;
 
-void dma_handler_b() {
-    dma_handler((uint8_t*)&capture_buf_b, 1);
-    dma_hw->ints1 = 1u << dma_chan_b;
-    dma_channel_set_write_addr(dma_chan_b, &capture_buf_b, false);
+void block_handler(dma_stream_t* stream, dma_stream_block_t* block, void* arg) {
+    printf("DMA IRQ %d [%d %d %d]\n", block->index % 2, block->data[0], block->data[1], block->data[2]);
 }
 
 int main() {
@@ -46,56 +34,27 @@ int main() {
     adc_set_clkdiv(0);
 
     printf("Arming DMA.\n");
-    dma_channel_config dma_cfg_a, dma_cfg_b;
-
-    dma_chan_a = dma_claim_unused_channel(true);
-    dma_chan_b = dma_claim_unused_channel(true);
-
-    dma_cfg_a = dma_channel_get_default_config(dma_chan_a);
-    dma_cfg_b = dma_channel_get_default_config(dma_chan_b);
-
-    channel_config_set_transfer_data_size(&dma_cfg_a, DMA_SIZE_8);
-    channel_config_set_transfer_data_size(&dma_cfg_b, DMA_SIZE_8);
-
-    channel_config_set_read_increment(&dma_cfg_a, false);
-    channel_config_set_read_increment(&dma_cfg_b, false);
-
-    channel_config_set_write_increment(&dma_cfg_a, true);
-    channel_config_set_write_increment(&dma_cfg_b, true);
-
-    channel_config_set_dreq(&dma_cfg_a, DREQ_ADC);
-    channel_config_set_dreq(&dma_cfg_b, DREQ_ADC);
-
-    channel_config_set_chain_to(&dma_cfg_a, dma_chan_b);
-    channel_config_set_chain_to(&dma_cfg_b, dma_chan_a);
-
-    dma_channel_configure(dma_chan_a, &dma_cfg_a,
-        capture_buf_a,  // dst
-        &adc_hw->fifo,  // src
-        CAPTURE_DEPTH,  // transfer count
-        true            // start now
-    );
-
-    dma_channel_configure(dma_chan_b, &dma_cfg_b,
-        capture_buf_b,  // dst
-        &adc_hw->fifo,  // src
-        CAPTURE_DEPTH,  // transfer count
-        false           // start now
-    );
-
-    dma_channel_set_irq0_enabled(dma_chan_a, true);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler_a);
-    irq_set_enabled(DMA_IRQ_0, true);
-
-    dma_channel_set_irq1_enabled(dma_chan_b, true);
-    irq_set_exclusive_handler(DMA_IRQ_1, dma_handler_b);
-    irq_set_enabled(DMA_IRQ_1, true);
+    dma_stream_config_t cfg = {
+        .dreq = DREQ_ADC,
+        .src = &adc_hw->fifo,
+        .element_size = DMA_SIZE_8,
+        .block_size = CAPTURE_DEPTH,
+        .buffer_count = 2,
+        .buffers = { capture_buf_a, capture_buf_b },
+        .checksum = DMA_STREAM_CHECKSUM_NONE,
+        .irq = DMA_IRQ_0,
+    };
+
+    dma_stream_init(&stream, &cfg);
+    dma_stream_add_callback(&stream, block_handler, NULL);
 
     printf("Start capture.\n");
+    dma_stream_start(&stream);
     adc_run(true);
 
-    while (true)
-        tight_loop_contents();
+    while (true) {
+        dma_stream_service(&stream);
+    }
 
     printf("Bye from pico!\n\n");
 
@@ -0,0 +1,139 @@
+#ifndef DOWNLOAD_H
+#define DOWNLOAD_H
+
+#include "recording.h"
+
+// Binary download of a recording, or of the whole flash, in CRC-checked
+// frames. The same protocol runs over stdio ('B' command) and TCP:
+//
+//   host    download_request_t: what to send and from which offset.
+//   device  download_reply_t: the status and the total size.
+//   device  Frames until the end: download_frame_t and `size` payload bytes.
+//
+// A frame that fails its CRC, or a stalled link, is resumed by requesting
+// again from the last good offset. Over stdio, any byte received during a
+// transfer aborts it so the next request can be read.
+
+#define DOWNLOAD_REQUEST_MAGIC  0x51524C44  // "DLRQ"
+#define DOWNLOAD_REPLY_MAGIC    0x50524C44  // "DLRP"
+#define DOWNLOAD_FRAME_MAGIC    0x4644      // "DF"
+
+#define DOWNLOAD_FLASH          0xFFFFFFFF  // Request the whole flash instead of a recording.
+
+#define DOWNLOAD_OK             0
+#define DOWNLOAD_ERR_NOT_FOUND  -1
+#define DOWNLOAD_ERR_OFFSET     -2
+
+#ifndef DOWNLOAD_FRAME_SIZE
+#define DOWNLOAD_FRAME_SIZE 4096
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t file;              // Recording number, or DOWNLOAD_FLASH.
+    uint32_t offset;            // Where to start, to resume a transfer.
+} download_request_t;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status;             // DOWNLOAD_OK or DOWNLOAD_ERR_*, no frames follow an error.
+    uint32_t size;              // Of the whole file.
+} download_reply_t;
+
+typedef struct {
+    uint16_t magic;
+    uint16_t size;              // Payload bytes.
+    uint32_t offset;            // Of the payload in the file.
+    uint32_t crc;               // CRC-32 (zlib) of the payload.
+} download_frame_t;
+
+typedef struct {
+    lfs_t* lfs;
+    lfs_file_t file;
+    bool is_file;               // Otherwise the flash, straight from XIP.
+    uint32_t size;
+    uint32_t pos;
+
+    // Reads that can't be mapped: inline files.
+    uint8_t buffer[DOWNLOAD_FRAME_SIZE];
+} download_t;
+
+static inline download_reply_t download_open(download_t* dl, lfs_t* lfs, const download_request_t* req) {
+    dl->lfs = lfs;
+    dl->is_file = false;
+    dl->pos = req->offset;
+
+    download_reply_t reply = { .magic = DOWNLOAD_REPLY_MAGIC, .status = DOWNLOAD_OK };
+
+    if (req->file == DOWNLOAD_FLASH) {
+        dl->size = PICO_FLASH_SIZE_BYTES;
+    } else {
+        char filename[64] = {0};
+        sprintf(filename, "REC_%03u", req->file);
+
+        if (lfs_file_open(lfs, &dl->file, filename, LFS_O_RDONLY) != LFS_ERR_OK) {
+            reply.status = DOWNLOAD_ERR_NOT_FOUND;
+            return reply;
+        }
+
+        dl->is_file = true;
+        dl->size = lfs_file_size(lfs, &dl->file);
+    }
+
+    reply.size = dl->size;
+
+    if (dl->pos > dl->size) {
+        reply.status = DOWNLOAD_ERR_OFFSET;
+    }
+
+    return reply;
+}
+
+static inline void download_close(download_t* dl) {
+    if (dl->is_file) {
+        lfs_file_close(dl->lfs, &dl->file);
+        dl->is_file = false;
+    }
+}
+
+// The next frame, its payload pointing into the flash when it can be mapped
+// and into `dl->buffer` otherwise. Returns false at the end or on an error.
+static inline bool download_next(download_t* dl, download_frame_t* frame, const uint8_t** data) {
+    if (dl->pos >= dl->size) {
+        return false;
+    }
+
+    uint32_t size = MIN(dl->size - dl->pos, DOWNLOAD_FRAME_SIZE);
+
+    if (!dl->is_file) {
+        *data = (const uint8_t*)(XIP_NOCACHE_NOALLOC_BASE + dl->pos);
+    } else {
+        lfs_size_t span;
+
+        if (lfs_rp2040_file_span(dl->lfs, &dl->file, dl->pos, data, &span) == LFS_ERR_OK) {
+            size = MIN(size, span);
+        } else {
+            lfs_file_seek(dl->lfs, &dl->file, dl->pos, LFS_SEEK_SET);
+            const lfs_ssize_t n = lfs_file_read(dl->lfs, &dl->file, dl->buffer, size);
+            if (n <= 0) {
+                return false;
+            }
+
+            size = n;
+            *data = dl->buffer;
+        }
+    }
+
+    *frame = (download_frame_t){
+        .magic = DOWNLOAD_FRAME_MAGIC,
+        .size = size,
+        .offset = dl->pos,
+        .crc = recording_crc32(*data, size),
+    };
+
+    dl->pos += size;
+
+    return true;
+}
+
+#endif
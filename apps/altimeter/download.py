@@ -0,0 +1,158 @@
+import os
+import socket
+import struct
+import sys
+import time
+import zlib
+
+# Downloads a recording, or the whole flash, with the binary protocol of
+# download.h and prints the throughput. Frames failing their CRC and
+# stalled links are resumed from the last good offset.
+#
+#   python3 download.py /dev/ttyACM0 3 REC_003.bin      # USB serial, CLI mode.
+#   python3 download.py 192.168.7.1 flash flash.bin     # altimeter_net over TCP.
+#   python3 download.py /dev/ttyACM0 3 REC_003.bin --resume
+#
+# --resume continues a previous download from the size of the output file.
+
+REQUEST = struct.Struct("<III")
+REPLY = struct.Struct("<IiI")
+FRAME = struct.Struct("<HHII")
+
+REQUEST_MAGIC = 0x51524C44
+REPLY_MAGIC = 0x50524C44
+FRAME_MAGIC = 0x4644
+FLASH = 0xFFFFFFFF
+
+ERRORS = {-1: "not found", -2: "offset past the end"}
+
+NET_PORT = 7781
+TIMEOUT = 2.0
+MAX_RETRIES = 10
+
+
+class Serial:
+    def __init__(self, path):
+        import serial
+        self.port = serial.Serial(path, timeout=TIMEOUT)
+
+    def request(self, request):
+        self.port.write(b"B" + request)
+
+    def abort(self):
+        # Any byte stops the transfer, then the CLI goes quiet.
+        self.port.write(b"A")
+        while self.port.read(4096):
+            pass
+
+    def read(self, size):
+        return self.port.read(size)
+
+
+class Tcp:
+    def __init__(self, host):
+        self.host = host
+        self.connect()
+
+    def connect(self):
+        self.sock = socket.create_connection((self.host, NET_PORT), timeout=TIMEOUT)
+
+    def request(self, request):
+        self.sock.sendall(request)
+
+    def abort(self):
+        # Frames already in flight would follow a new request, reconnect instead.
+        self.sock.close()
+        self.connect()
+
+    def read(self, size):
+        data = bytearray()
+        try:
+            while len(data) < size:
+                chunk = self.sock.recv(size - len(data))
+                if not chunk:
+                    break
+                data += chunk
+        except socket.timeout:
+            pass
+        return bytes(data)
+
+
+class Stalled(Exception):
+    pass
+
+
+def read_exact(link, size):
+    data = link.read(size)
+    if len(data) != size:
+        raise Stalled("timeout")
+    return data
+
+
+def sync(link):
+    # Console text may precede the reply.
+    window = b""
+    while True:
+        byte = read_exact(link, 1)
+        window = (window + byte)[-4:]
+        if window == struct.pack("<I", REPLY_MAGIC):
+            return window + read_exact(link, REPLY.size - 4)
+
+
+def transfer(link, file, offset, out):
+    """Requests from offset and writes good frames. Returns (offset, size)."""
+    link.request(REQUEST.pack(REQUEST_MAGIC, file, offset))
+
+    _, status, size = REPLY.unpack(sync(link))
+    if status != 0:
+        raise RuntimeError(ERRORS.get(status, f"error {status}"))
+
+    while offset < size:
+        magic, length, frame_offset, crc = FRAME.unpack(read_exact(link, FRAME.size))
+        if magic != FRAME_MAGIC or frame_offset != offset:
+            raise Stalled("out of sync")
+
+        payload = read_exact(link, length)
+        if zlib.crc32(payload) != crc:
+            raise Stalled(f"bad CRC at {offset}")
+
+        out.write(payload)
+        offset += length
+
+    return offset, size
+
+
+def main(target, file, path, *flags):
+    file = FLASH if file == "flash" else int(file)
+    link = Serial(target) if target.startswith("/dev/") or target.startswith("COM") else Tcp(target)
+
+    offset = os.path.getsize(path) if "--resume" in flags and os.path.exists(path) else 0
+    start_offset = offset
+    retries = 0
+    start = time.perf_counter()
+
+    with open(path, "r+b" if offset else "wb") as out:
+        out.seek(offset)
+
+        while True:
+            try:
+                offset, size = transfer(link, file, offset, out)
+                break
+            except Stalled as e:
+                offset = out.tell()
+                retries += 1
+                print(f"{e}, resuming at {offset}")
+                if retries > MAX_RETRIES:
+                    raise RuntimeError("too many retries")
+                link.abort()
+
+        out.truncate(size)
+
+    elapsed = time.perf_counter() - start
+    received = offset - start_offset
+    print(f"{path}: {size} bytes, {received} received in {elapsed:.2f} s, "
+          f"{received / elapsed / 1000:.1f} kB/s, {retries} retries")
+
+
+if __name__ == "__main__":
+    main(*sys.argv[1:])
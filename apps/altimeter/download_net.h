@@ -0,0 +1,240 @@
+#ifndef DOWNLOAD_NET_H
+#define DOWNLOAD_NET_H
+
+#include "usb_network.h"
+#include "lwip/tcp.h"
+
+#include "download.h"
+
+// The download protocol of download.h on a TCP port of the USB network
+// interface, one client at a time. Payloads mapped from the flash are
+// handed to lwIP without a copy, nothing writes the flash while the CLI
+// serves downloads. A new request on the connection stops the current
+// transfer once the frame in progress is written, then its reply follows.
+// Frames of the old transfer may still precede the reply, so download.py
+// resumes on a new connection instead.
+
+#ifndef DOWNLOAD_NET_PORT
+#define DOWNLOAD_NET_PORT 7781
+#endif
+
+static struct {
+    struct tcp_pcb* pcb;
+    lfs_t* lfs;
+    download_t download;
+    download_request_t request;
+    uint32_t request_fill;
+    download_request_t next;    // Waits for the frame in progress.
+    bool next_pending;
+    download_reply_t reply;
+    bool reply_pending;         // Written once the send buffer has room.
+
+    bool sending;
+    download_frame_t frame;
+    const uint8_t* data;
+    uint32_t frame_pos;         // Bytes of the frame, header and payload, written.
+    bool frame_pending;
+
+    uint32_t connections;
+} download_net;
+
+static void download_net_open() {
+    download_close(&download_net.download);
+    download_net.next_pending = false;
+
+    download_net.reply = download_open(&download_net.download, download_net.lfs, &download_net.next);
+    download_net.reply_pending = true;
+
+    download_net.sending = download_net.reply.status == DOWNLOAD_OK;
+    if (!download_net.sending) {
+        download_close(&download_net.download);
+    }
+}
+
+static void download_net_send() {
+    struct tcp_pcb* pcb = download_net.pcb;
+    bool written = false;
+
+    while (pcb) {
+        // The host parses whole frames, a new transfer starts between two.
+        if (download_net.next_pending && !download_net.frame_pending) {
+            download_net_open();
+        }
+
+        if (download_net.reply_pending) {
+            if (tcp_sndbuf(pcb) < sizeof(download_reply_t) || tcp_sndqueuelen(pcb) + 1 > TCP_SND_QUEUELEN ||
+                tcp_write(pcb, &download_net.reply, sizeof(download_reply_t), TCP_WRITE_FLAG_COPY) != ERR_OK) {
+                break;
+            }
+
+            download_net.reply_pending = false;
+            written = true;
+        }
+
+        if (!download_net.sending) {
+            break;
+        }
+
+        if (!download_net.frame_pending) {
+            if (!download_next(&download_net.download, &download_net.frame, &download_net.data)) {
+                download_net.sending = false;
+                download_close(&download_net.download);
+                break;
+            }
+
+            download_net.frame_pending = true;
+            download_net.frame_pos = 0;
+        }
+
+        const uint32_t header = sizeof(download_frame_t);
+        const uint32_t total = header + download_net.frame.size;
+        const u16_t space = tcp_sndbuf(pcb);
+
+        if (space == 0 || tcp_sndqueuelen(pcb) + 2 > TCP_SND_QUEUELEN) {
+            break;
+        }
+
+        err_t err;
+        uint32_t len;
+
+        if (download_net.frame_pos < header) {
+            len = header - download_net.frame_pos;
+            if (space < len) {
+                break;
+            }
+
+            err = tcp_write(pcb, (const uint8_t*)&download_net.frame + download_net.frame_pos, len,
+                            TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE);
+        } else {
+            // A payload read into the buffer is copied, the next frame reuses it.
+            const uint32_t offset = download_net.frame_pos - header;
+            const u8_t copy = download_net.data == download_net.download.buffer ? TCP_WRITE_FLAG_COPY : 0;
+
+            len = MIN(space, total - download_net.frame_pos);
+            err = tcp_write(pcb, download_net.data + offset, len, copy | TCP_WRITE_FLAG_MORE);
+        }
+
+        if (err != ERR_OK) {
+            break;
+        }
+
+        download_net.frame_pos += len;
+        download_net.frame_pending = download_net.frame_pos < total;
+        written = true;
+    }
+
+    if (written) {
+        tcp_output(pcb);
+    }
+}
+
+// A request that wasn't answered yet is replaced, the host only waits for
+// the last reply.
+static void download_net_start() {
+    download_net.next = download_net.request;
+    download_net.next_pending = true;
+
+    download_net_send();
+}
+
+static void download_net_release() {
+    download_close(&download_net.download);
+    download_net.pcb = NULL;
+    download_net.sending = false;
+    download_net.frame_pending = false;
+    download_net.next_pending = false;
+    download_net.reply_pending = false;
+}
+
+// Reset rather than closed: lwIP would keep unacknowledged payloads that
+// point into the flash after the connection is gone, and the CLI may then
+// format it.
+static void download_net_close() {
+    tcp_arg(download_net.pcb, NULL);
+    tcp_sent(download_net.pcb, NULL);
+    tcp_recv(download_net.pcb, NULL);
+    tcp_err(download_net.pcb, NULL);
+    tcp_poll(download_net.pcb, NULL, 0);
+    tcp_abort(download_net.pcb);
+
+    download_net_release();
+}
+
+static void download_net_err(void *arg, err_t err) {
+    // The pcb was already freed by lwIP.
+    download_net_release();
+}
+
+static err_t download_net_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    download_net_send();
+    return ERR_OK;
+}
+
+// A write that failed with nothing in flight gets no sent callback.
+static err_t download_net_poll(void *arg, struct tcp_pcb *pcb) {
+    download_net_send();
+    return ERR_OK;
+}
+
+static err_t download_net_receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    // The client closed the connection.
+    if (p == NULL) {
+        download_net_close();
+        return ERR_ABRT;
+    }
+
+    tcp_recved(pcb, p->tot_len);
+
+    for (u16_t i = 0; i < p->tot_len && download_net.pcb; i++) {
+        ((uint8_t*)&download_net.request)[download_net.request_fill++] = pbuf_get_at(p, i);
+
+        if (download_net.request_fill < sizeof(download_net.request)) {
+            continue;
+        }
+
+        download_net.request_fill = 0;
+
+        if (download_net.request.magic != DOWNLOAD_REQUEST_MAGIC) {
+            download_net_close();
+            break;
+        }
+
+        download_net_start();
+    }
+
+    pbuf_free(p);
+    return download_net.pcb ? ERR_OK : ERR_ABRT;
+}
+
+static err_t download_net_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK) {
+        return err;
+    }
+
+    if (download_net.pcb) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+
+    download_net.pcb = pcb;
+    download_net.request_fill = 0;
+    download_net.connections += 1;
+
+    tcp_setprio(pcb, TCP_PRIO_MAX);
+    tcp_recv(pcb, download_net_receive);
+    tcp_sent(pcb, download_net_sent);
+    tcp_err(pcb, download_net_err);
+    tcp_poll(pcb, download_net_poll, 2);
+
+    return ERR_OK;
+}
+
+static inline void download_net_init(lfs_t* lfs) {
+    download_net.lfs = lfs;
+
+    struct tcp_pcb* pcb = tcp_new();
+    tcp_bind(pcb, IP_ADDR_ANY, DOWNLOAD_NET_PORT);
+    tcp_accept(tcp_listen(pcb), download_net_accept);
+}
+
+#endif
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "lfs_rp2040.h"
+#include "recording.h"
+
+// Records at the altimeter rate on the emulated flash, cuts the power at a
+// random flash operation and counts the samples missing after the reboot.
+// Exits with an error when a cut loses more than the documented window,
+// one sync interval plus one sample, or when the recording is corrupted.
+//
+//   ./loss_window [sync_interval_ms] [cuts]
+
+#define SAMPLE_PERIOD_MS 250
+#define MAX_SAMPLES 100000
+
+static struct lfs_config cfg;
+static lfs_t lfs;
+static recording_t recording;
+
+static bool mount() {
+    return lfs_rp2040_init(&cfg) && lfs_mount(&lfs, &cfg) == LFS_ERR_OK;
+}
+
+// Returns the samples in the file, or -1 when they aren't 0, 1, 2... or a
+// block is damaged.
+static int32_t check_recording() {
+    recording_reader_t reader;
+    if (!recording_reader_open(&reader, &lfs, "REC", LFS_O_RDONLY)) {
+        return 0;
+    }
+
+    static recording_samples_t block;
+    int32_t count = 0;
+
+    for (uint32_t b = 0; b <= reader.blocks && count >= 0; b++) {
+        const int32_t n = recording_read_block(&reader, b, &block);
+
+        if (n < 0 || (n > 0 && block.header.first_index != (uint32_t)count)) {
+            count = -1;
+            break;
+        }
+
+        for (int32_t i = 0; i < n; i++) {
+            if (lroundf(block.samples[i].pressure) != count + i) {
+                count = -1;
+                break;
+            }
+        }
+
+        if (count >= 0) {
+            count += n;
+        }
+    }
+
+    recording_reader_close(&reader);
+
+    return count;
+}
+
+// Finalizes the recording: the samples must stay the same and the time of
+// every sample must seek to the block holding it. A recording cut before
+// its header was synced has nothing to finalize.
+static bool check_finalize(int32_t found) {
+    if (!recording_finalize(&lfs, "REC")) {
+        return found == 0;
+    }
+
+    if (check_recording() != found) {
+        return false;
+    }
+
+    recording_reader_t reader;
+    if (!recording_reader_open(&reader, &lfs, "REC", LFS_O_RDONLY)) {
+        return false;
+    }
+
+    static recording_samples_t block;
+    bool ok = reader.indexed && reader.tail == 0;
+
+    for (uint32_t b = 0; ok && b < reader.blocks; b++) {
+        const int32_t n = recording_read_block(&reader, b, &block);
+
+        for (int32_t i = 0; ok && i < n; i += 7) {
+            const uint64_t offset_us = block.header.timestamp_us + block.samples[i].offset_us - reader.footer.start_us;
+            ok = recording_find_block(&reader, offset_us) == b;
+        }
+    }
+
+    recording_reader_close(&reader);
+
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    const uint32_t sync_interval_ms = argc > 1 ? atoi(argv[1]) : RECORDER_SYNC_INTERVAL_MS;
+    const uint32_t cuts = argc > 2 ? atoi(argv[2]) : 100;
+
+    const nor_flash_config_t flash = {
+        .size = 2 * 1024 * 1024,
+        .reserved = 256 * 1024,
+        .latency = NOR_FLASH_LATENCY_W25Q16,
+    };
+
+    if (!nor_flash_open(&flash)) {
+        return 1;
+    }
+
+    const uint32_t bound = sync_interval_ms / SAMPLE_PERIOD_MS + 1;
+    uint32_t worst = 0;
+
+    srand(1);
+
+    for (uint32_t cut = 0; cut < cuts; cut++) {
+        if (!lfs_rp2040_init(&cfg) || lfs_format(&lfs, &cfg) || !mount()) {
+            printf("cut %u: format failed\n", cut);
+            return 1;
+        }
+
+        const recording_header_t info = {
+            .sensor = RECORDING_SENSOR_BMP390,
+            .period_us = SAMPLE_PERIOD_MS * 1000,
+        };
+
+        if (!recording_open(&recording, &lfs, "REC", &info, RECORDING_CODEC_PACKED, sync_interval_ms)) {
+            return 1;
+        }
+
+        nor_flash_cut_power_after(1 + rand() % 2000);
+
+        // Samples handed to the recorder before the power went out.
+        uint32_t recorded = 0;
+
+        while (!nor_flash_power_lost() && recorded < MAX_SAMPLES) {
+            recording_append(&recording, time_us_64(), recorded, 20.0f, recorded);
+            recorded += 1;
+            sleep_ms(SAMPLE_PERIOD_MS);
+        }
+
+        // Reboot.
+        nor_flash_cut_power_after(0);
+        nor_flash_power_on();
+
+        if (!mount()) {
+            printf("cut %u: mount failed\n", cut);
+            return 1;
+        }
+
+        const int32_t found = check_recording();
+
+        if (found < 0 || (uint32_t)found > recorded) {
+            printf("cut %u: recording corrupted\n", cut);
+            return 1;
+        }
+
+        if (!check_finalize(found)) {
+            printf("cut %u: finalize failed\n", cut);
+            return 1;
+        }
+
+        lfs_unmount(&lfs);
+
+        const uint32_t lost = recorded - found;
+        if (lost > worst) {
+            worst = lost;
+        }
+
+        if (lost > bound) {
+            printf("cut %u: lost %u samples, more than %u\n", cut, lost, bound);
+            return 1;
+        }
+    }
+
+    printf("sync %u ms, %u cuts: worst loss %u samples (%u ms), bound %u samples\n",
+           sync_interval_ms, cuts, worst, worst * SAMPLE_PERIOD_MS, bound);
+
+    nor_flash_close();
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <lfs_rp2040.h>
+
+// Samples are collected in a RAM batch and written to the file a page at a
+// time. The file is synced, a LittleFS metadata commit, once per sync
+// interval. Data written since the last sync is lost on a power cut: at
+// most one interval plus the sample that triggers the sync. Samples still
+// waiting in the app's queue (up to SAMPLE_QUEUE_SIZE, 64) are lost too.
+
+#ifndef RECORDER_BATCH_SIZE
+#define RECORDER_BATCH_SIZE FLASH_PAGE_SIZE
+#endif
+
+#ifndef RECORDER_SYNC_INTERVAL_MS
+#define RECORDER_SYNC_INTERVAL_MS 10000
+#endif
+
+typedef struct {
+    lfs_t* lfs;
+    lfs_file_t file;
+    uint32_t sync_interval_ms;
+    uint64_t last_sync_us;
+    uint32_t fill;
+    uint8_t batch[RECORDER_BATCH_SIZE];
+
+    uint32_t samples;
+    uint32_t writes;
+    uint32_t syncs;
+    uint32_t errors;
+} recorder_t;
+
+static inline bool recorder_open(recorder_t* rec, lfs_t* lfs, const char* name, uint32_t sync_interval_ms) {
+    memset(rec, 0, sizeof(*rec));
+
+    rec->lfs = lfs;
+    rec->sync_interval_ms = sync_interval_ms;
+    rec->last_sync_us = time_us_64();
+
+    return lfs_file_open(lfs, &rec->file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) == LFS_ERR_OK;
+}
+
+static inline bool recorder_write_batch(recorder_t* rec) {
+    if (rec->fill == 0) {
+        return true;
+    }
+
+    const lfs_ssize_t written = lfs_file_write(rec->lfs, &rec->file, rec->batch, rec->fill);
+    rec->fill = 0;
+    rec->writes += 1;
+
+    if (written < 0) {
+        rec->errors += 1;
+        return false;
+    }
+
+    return true;
+}
+
+// Writes the batch and commits the file, everything recorded so far
+// survives a power cut.
+static inline bool recorder_sync(recorder_t* rec) {
+    bool ok = recorder_write_batch(rec);
+
+    if (lfs_file_sync(rec->lfs, &rec->file)) {
+        rec->errors += 1;
+        ok = false;
+    }
+
+    rec->syncs += 1;
+    rec->last_sync_us = time_us_64();
+
+    return ok;
+}
+
+static inline bool recorder_append(recorder_t* rec, const void* sample, uint32_t size) {
+    if (size > RECORDER_BATCH_SIZE) {
+        return false;
+    }
+
+    if (rec->fill + size > RECORDER_BATCH_SIZE && !recorder_write_batch(rec)) {
+        return false;
+    }
+
+    memcpy(rec->batch + rec->fill, sample, size);
+    rec->fill += size;
+    rec->samples += 1;
+
+    if (time_us_64() - rec->last_sync_us >= (uint64_t)rec->sync_interval_ms * 1000) {
+        return recorder_sync(rec);
+    }
+
+    return true;
+}
+
+static inline bool recorder_close(recorder_t* rec) {
+    const bool ok = recorder_sync(rec);
+    return lfs_file_close(rec->lfs, &rec->file) == LFS_ERR_OK && ok;
+}
+
+#endif
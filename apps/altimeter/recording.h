@@ -0,0 +1,746 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+
+#include "dma_sniff.h"
+#include "recorder.h"
+
+// Recording file format, version 2. Little-endian, every field aligned.
+//
+//   header    recording_header_t, `header_size` bytes.
+//   blocks    recording_block_t or recording_packed_block_t, `block_size`
+//             bytes each. Block n starts at header_size + n * block_size, a
+//             damaged block never shifts the ones after it.
+//   index     Optional, written by recording_finalize(): one block number
+//             per `interval_ms` followed by recording_footer_t at the very
+//             end of the file.
+//
+// Blocks are appended as the samples come in, a recording that was never
+// finalized ends in an unfinished block: a header and whole or torn samples,
+// without trailer. CRCs are the CRC-32 of zlib (and of the DMA sniffer in
+// its reflected mode).
+//
+// The magic of a block gives its codec. Raw blocks (version 1) store 19
+// samples as floats. Packed blocks (version 2) quantize the samples and
+// store the first one whole, then per sample the zig-zag varints of three
+// deltas: the time minus the nominal period, the temperature and the
+// pressure. Slowly changing samples take about 3 bytes instead of 12.
+
+#define RECORDING_MAGIC         0x52544C41  // "ALTR"
+#define RECORDING_BLOCK_MAGIC   0x4B4C4252  // "RBLK", raw samples.
+#define RECORDING_PACKED_MAGIC  0x5A4C4252  // "RBLZ", packed samples.
+#define RECORDING_FOOTER_MAGIC  0x58444952  // "RIDX"
+#define RECORDING_VERSION       2           // Version 1 has raw blocks only.
+
+#define RECORDING_SENSOR_BMP390 1
+
+#ifndef RECORDING_BLOCK_SIZE
+#define RECORDING_BLOCK_SIZE FLASH_PAGE_SIZE
+#endif
+
+// Resolution of the packed codec: 0.01 ºC, and 0.01 hPa (1 Pa, about 8 cm
+// of altitude) for the pressure.
+#define RECORDING_TEMPERATURE_STEP 0.01f
+#define RECORDING_PRESSURE_STEP 0.01f
+
+typedef enum {
+    RECORDING_CODEC_RAW,
+    RECORDING_CODEC_PACKED,
+} recording_codec_t;
+
+// Time covered by each entry of the index. A seek reads one entry, then the
+// headers of the few blocks that start in the interval.
+#ifndef RECORDING_INDEX_INTERVAL_MS
+#define RECORDING_INDEX_INTERVAL_MS 10000
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;       // Bytes before the first block.
+    uint16_t block_size;
+    uint8_t sensor;             // RECORDING_SENSOR_*.
+    uint8_t oversampling;       // Sensor setting, BMP390 OSR.
+    uint32_t period_us;         // Nominal sample period.
+    uint32_t boot_count;        // Recording number, REC_<boot_count>.
+    uint32_t crc;               // Of the fields above.
+} recording_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t first_index;       // Sample number of the first sample. Samples of a block are consecutive.
+    uint64_t timestamp_us;      // Time of the first sample, since boot.
+} recording_block_header_t;
+
+typedef struct {
+    uint32_t offset_us;         // Since the first sample of the block.
+    float temperature;
+    float pressure;
+} recording_sample_t;
+
+typedef struct {
+    uint32_t count;             // Samples in the block.
+    uint32_t crc;               // Of the whole block before this field.
+} recording_block_trailer_t;
+
+#define RECORDING_BLOCK_SAMPLES ((RECORDING_BLOCK_SIZE - sizeof(recording_block_header_t) \
+    - sizeof(recording_block_trailer_t)) / sizeof(recording_sample_t))
+
+#define RECORDING_BLOCK_PADDING (RECORDING_BLOCK_SIZE - sizeof(recording_block_header_t) \
+    - sizeof(recording_block_trailer_t) - RECORDING_BLOCK_SAMPLES * sizeof(recording_sample_t))
+
+typedef struct {
+    recording_block_header_t header;
+    recording_sample_t samples[RECORDING_BLOCK_SAMPLES];
+    uint8_t padding[RECORDING_BLOCK_PADDING];   // Zeros.
+    recording_block_trailer_t trailer;
+} recording_block_t;
+
+static_assert(sizeof(recording_block_t) == RECORDING_BLOCK_SIZE, "recording block layout");
+
+#define RECORDING_PACKED_DATA_SIZE (RECORDING_BLOCK_SIZE - sizeof(recording_block_header_t) \
+    - 2 * sizeof(int32_t) - sizeof(recording_block_trailer_t))
+
+// The first sample, then at least 3 bytes per sample.
+#define RECORDING_PACKED_SAMPLES (1 + RECORDING_PACKED_DATA_SIZE / 3)
+
+typedef struct {
+    recording_block_header_t header;
+    int32_t temperature;        // First sample, in RECORDING_TEMPERATURE_STEP.
+    int32_t pressure;           // First sample, in RECORDING_PRESSURE_STEP.
+    uint8_t data[RECORDING_PACKED_DATA_SIZE];   // Varints of the next samples, then zeros.
+    recording_block_trailer_t trailer;
+} recording_packed_block_t;
+
+static_assert(sizeof(recording_packed_block_t) == RECORDING_BLOCK_SIZE, "recording packed block layout");
+
+// A block of either codec, the header and the trailer are shared.
+typedef union {
+    recording_block_header_t header;
+    recording_block_t raw;
+    recording_packed_block_t packed;
+    uint8_t bytes[RECORDING_BLOCK_SIZE];
+} recording_buffer_t;
+
+// The samples of a block, decoded.
+typedef struct {
+    recording_block_header_t header;
+    recording_sample_t samples[RECORDING_PACKED_SAMPLES];
+} recording_samples_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t blocks;            // Blocks before the index.
+    uint32_t interval_ms;
+    uint32_t entries;           // Entry i is the last block starting at or before start_us + i * interval_ms.
+    uint64_t start_us;          // Timestamp of the first sample.
+    uint32_t samples;
+    uint32_t crc;               // Of the entries and the fields above.
+} recording_footer_t;
+
+// CRC-32 (zlib). The DMA sniffer computes it on its own channel, the
+// software loop is the fallback without a free channel.
+static inline uint32_t recording_crc32_update(uint32_t crc, const void* data, uint32_t size) {
+    const uint8_t* bytes = data;
+
+    crc = ~crc;
+    while (size--) {
+        crc ^= *bytes++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return ~crc;
+}
+
+static inline uint32_t recording_crc32(const void* data, uint32_t size) {
+    static dma_sniff_t sniff;
+    static int ready = -1;
+
+    if (ready < 0) {
+        ready = dma_sniff_init(&sniff);
+    }
+
+    return ready ? dma_sniff_crc32(&sniff, data, size) : recording_crc32_update(0, data, size);
+}
+
+static inline bool recording_header_valid(const recording_header_t* header) {
+    return header->magic == RECORDING_MAGIC &&
+           header->version >= 1 && header->version <= RECORDING_VERSION &&
+           header->header_size >= sizeof(recording_header_t) &&
+           header->block_size == sizeof(recording_block_t) &&
+           header->crc == recording_crc32(header, offsetof(recording_header_t, crc));
+}
+
+static inline bool recording_block_magic_valid(uint32_t magic) {
+    return magic == RECORDING_BLOCK_MAGIC || magic == RECORDING_PACKED_MAGIC;
+}
+
+static inline void recording_seal_block(recording_buffer_t* block, uint32_t count) {
+    block->raw.trailer.count = count;
+    block->raw.trailer.crc = recording_crc32(block, offsetof(recording_block_t, trailer.crc));
+}
+
+// Packed codec.
+
+typedef struct {
+    uint32_t fill;              // Bytes of `data` used.
+    uint64_t last_us;
+    int32_t temperature;        // Quantized, of the last sample.
+    int32_t pressure;
+} recording_packer_t;
+
+static inline uint32_t recording_put_varint(uint8_t* out, int32_t value) {
+    uint32_t zz = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    uint32_t n = 0;
+
+    while (zz >= 0x80) {
+        out[n++] = zz | 0x80;
+        zz >>= 7;
+    }
+    out[n++] = zz;
+
+    return n;
+}
+
+static inline bool recording_get_varint(const uint8_t* data, uint32_t size, uint32_t* pos, int32_t* value) {
+    uint32_t zz = 0;
+
+    for (uint32_t shift = 0; *pos < size && shift < 35; shift += 7) {
+        const uint8_t byte = data[(*pos)++];
+        zz |= (uint32_t)(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *value = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static inline void recording_pack_first(recording_packed_block_t* block, recording_packer_t* packer,
+                                        uint64_t timestamp_us, float temperature, float pressure) {
+    block->temperature = lroundf(temperature * (1.0f / RECORDING_TEMPERATURE_STEP));
+    block->pressure = lroundf(pressure * (1.0f / RECORDING_PRESSURE_STEP));
+
+    *packer = (recording_packer_t){
+        .last_us = timestamp_us,
+        .temperature = block->temperature,
+        .pressure = block->pressure,
+    };
+}
+
+// Packs a sample after the first one. Returns the bytes added at the end of
+// `data`, 0 when they don't fit or the time delta doesn't fit 32 bits.
+static inline uint32_t recording_pack(recording_packed_block_t* block, recording_packer_t* packer, uint32_t period_us,
+                                      uint64_t timestamp_us, float temperature, float pressure) {
+    const int64_t jitter = (int64_t)(timestamp_us - packer->last_us) - period_us;
+    if (jitter < INT32_MIN || jitter > INT32_MAX) {
+        return 0;
+    }
+
+    const int32_t t = lroundf(temperature * (1.0f / RECORDING_TEMPERATURE_STEP));
+    const int32_t p = lroundf(pressure * (1.0f / RECORDING_PRESSURE_STEP));
+
+    uint8_t bytes[15];
+    uint32_t n = recording_put_varint(bytes, jitter);
+    n += recording_put_varint(bytes + n, t - packer->temperature);
+    n += recording_put_varint(bytes + n, p - packer->pressure);
+
+    if (packer->fill + n > sizeof(block->data)) {
+        return 0;
+    }
+
+    memcpy(block->data + packer->fill, bytes, n);
+    packer->fill += n;
+    packer->last_us = timestamp_us;
+    packer->temperature = t;
+    packer->pressure = p;
+
+    return n;
+}
+
+// Decodes the first `size` bytes of a block, all of them when it's sealed.
+// Returns the samples, or -1 for a damaged block. `end` is set to the bytes
+// used by the header and the samples, a torn sample at the end of an
+// unfinished block isn't counted.
+static inline int32_t recording_decode(const recording_buffer_t* block, uint32_t size, bool sealed,
+                                       uint32_t period_us, recording_samples_t* out, uint32_t* end) {
+    const uint32_t limit = sealed ? block->raw.trailer.count : UINT32_MAX;
+    uint32_t count = 0;
+
+    out->header = block->header;
+
+    if (block->header.magic == RECORDING_BLOCK_MAGIC) {
+        count = MIN(limit, (size - MIN(size, offsetof(recording_block_t, samples))) / sizeof(recording_sample_t));
+        if (count > RECORDING_BLOCK_SAMPLES) {
+            return -1;
+        }
+
+        memcpy(out->samples, block->raw.samples, count * sizeof(recording_sample_t));
+        *end = offsetof(recording_block_t, samples) + count * sizeof(recording_sample_t);
+
+        return count;
+    }
+
+    if (block->header.magic != RECORDING_PACKED_MAGIC || (sealed && limit > RECORDING_PACKED_SAMPLES)) {
+        return -1;
+    }
+
+    *end = offsetof(recording_packed_block_t, data);
+
+    if (size < *end || limit == 0) {
+        return 0;
+    }
+
+    const recording_packed_block_t* packed = &block->packed;
+    const uint32_t data_size = sealed ? sizeof(packed->data) : MIN(size, RECORDING_BLOCK_SIZE) - *end;
+
+    int32_t t = packed->temperature;
+    int32_t p = packed->pressure;
+    uint32_t offset_us = 0;
+    uint32_t pos = 0;
+
+    out->samples[count++] = (recording_sample_t){ 0, t * RECORDING_TEMPERATURE_STEP, p * RECORDING_PRESSURE_STEP };
+
+    while (count < limit && count < RECORDING_PACKED_SAMPLES) {
+        int32_t jitter, dt, dp;
+
+        if (!recording_get_varint(packed->data, data_size, &pos, &jitter) ||
+            !recording_get_varint(packed->data, data_size, &pos, &dt) ||
+            !recording_get_varint(packed->data, data_size, &pos, &dp)) {
+            if (sealed) {
+                return -1;
+            }
+            break;
+        }
+
+        offset_us += period_us + jitter;
+        t += dt;
+        p += dp;
+
+        out->samples[count++] = (recording_sample_t){ offset_us, t * RECORDING_TEMPERATURE_STEP, p * RECORDING_PRESSURE_STEP };
+        *end = offsetof(recording_packed_block_t, data) + pos;
+    }
+
+    return count;
+}
+
+// Writer: the samples go through the recorder, so they are batched and
+// synced like before and a power cut loses at most one sync interval.
+
+typedef struct {
+    recorder_t recorder;
+    recording_codec_t codec;
+    uint32_t period_us;
+
+    recording_buffer_t block;   // The block being filled, for its CRC.
+    recording_packer_t packer;
+    uint32_t count;             // Samples in it.
+
+    uint32_t blocks;            // Blocks sealed.
+    uint32_t gaps;              // Blocks sealed early on a skipped sample number.
+} recording_t;
+
+static inline bool recording_open(recording_t* rec, lfs_t* lfs, const char* name, const recording_header_t* info,
+                                  recording_codec_t codec, uint32_t sync_interval_ms) {
+    memset(rec, 0, sizeof(*rec));
+
+    if (!recorder_open(&rec->recorder, lfs, name, sync_interval_ms)) {
+        return false;
+    }
+
+    rec->codec = codec;
+    rec->period_us = info->period_us;
+
+    recording_header_t header = *info;
+    header.magic = RECORDING_MAGIC;
+    header.version = RECORDING_VERSION;
+    header.header_size = sizeof(header);
+    header.block_size = RECORDING_BLOCK_SIZE;
+    header.crc = recording_crc32(&header, offsetof(recording_header_t, crc));
+
+    // A file left open stays linked in the filesystem, opening it again loops.
+    if (!recorder_append(&rec->recorder, &header, sizeof(header))) {
+        lfs_file_close(lfs, &rec->recorder.file);
+        return false;
+    }
+
+    return true;
+}
+
+// Pads the block with its trailer and starts a new one.
+static inline bool recording_seal(recording_t* rec) {
+    if (rec->count == 0) {
+        return true;
+    }
+
+    recording_seal_block(&rec->block, rec->count);
+
+    // Everything after the last sample: unused space, then the trailer.
+    const uint32_t end = rec->codec == RECORDING_CODEC_PACKED ?
+        offsetof(recording_packed_block_t, data) + rec->packer.fill :
+        offsetof(recording_block_t, samples) + rec->count * sizeof(recording_sample_t);
+    const bool ok = recorder_append(&rec->recorder, rec->block.bytes + end, RECORDING_BLOCK_SIZE - end);
+
+    rec->count = 0;
+    rec->blocks += 1;
+
+    return ok;
+}
+
+static inline bool recording_append(recording_t* rec, uint64_t timestamp_us, uint32_t index,
+                                    float temperature, float pressure) {
+    recording_buffer_t* block = &rec->block;
+
+    // Sample numbers are implied by the block base, a skipped one (a queue
+    // overrun) or an offset past 32 bits needs a new base.
+    if (rec->count && (index != block->header.first_index + rec->count ||
+                       timestamp_us - block->header.timestamp_us > UINT32_MAX)) {
+        rec->gaps += 1;
+        if (!recording_seal(rec)) {
+            return false;
+        }
+    }
+
+    // The next sample of the block, a full block is sealed first.
+    if (rec->count) {
+        const uint8_t* bytes;
+        uint32_t size;
+
+        if (rec->codec == RECORDING_CODEC_PACKED) {
+            size = recording_pack(&block->packed, &rec->packer, rec->period_us, timestamp_us, temperature, pressure);
+            bytes = block->packed.data + rec->packer.fill - size;
+        } else if (rec->count < RECORDING_BLOCK_SAMPLES) {
+            recording_sample_t* sample = &block->raw.samples[rec->count];
+            *sample = (recording_sample_t){
+                .offset_us = timestamp_us - block->header.timestamp_us,
+                .temperature = temperature,
+                .pressure = pressure,
+            };
+            bytes = (const uint8_t*)sample;
+            size = sizeof(*sample);
+        } else {
+            bytes = NULL;
+            size = 0;
+        }
+
+        if (size) {
+            rec->count += 1;
+            return recorder_append(&rec->recorder, bytes, size);
+        }
+
+        if (!recording_seal(rec)) {
+            return false;
+        }
+    }
+
+    // The first sample of a block goes with its header.
+    memset(block, 0, sizeof(*block));
+    block->header = (recording_block_header_t){
+        .magic = rec->codec == RECORDING_CODEC_PACKED ? RECORDING_PACKED_MAGIC : RECORDING_BLOCK_MAGIC,
+        .first_index = index,
+        .timestamp_us = timestamp_us,
+    };
+
+    uint32_t size;
+
+    if (rec->codec == RECORDING_CODEC_PACKED) {
+        recording_pack_first(&block->packed, &rec->packer, timestamp_us, temperature, pressure);
+        size = offsetof(recording_packed_block_t, data);
+    } else {
+        block->raw.samples[0] = (recording_sample_t){ 0, temperature, pressure };
+        size = offsetof(recording_block_t, samples) + sizeof(recording_sample_t);
+    }
+
+    rec->count = 1;
+
+    return recorder_append(&rec->recorder, block, size);
+}
+
+// Reader.
+
+typedef struct {
+    lfs_t* lfs;
+    lfs_file_t file;
+    recording_header_t header;
+    recording_footer_t footer;
+    bool indexed;               // The footer is present, seeks are O(1).
+
+    uint32_t blocks;            // Sealed blocks.
+    uint32_t tail;              // Bytes of the unfinished block after them.
+
+    recording_buffer_t buffer;
+} recording_reader_t;
+
+static inline bool recording_read_at(recording_reader_t* reader, lfs_off_t pos, void* data, lfs_size_t size) {
+    return lfs_file_seek(reader->lfs, &reader->file, pos, LFS_SEEK_SET) >= 0 &&
+           lfs_file_read(reader->lfs, &reader->file, data, size) == (lfs_ssize_t)size;
+}
+
+static inline lfs_off_t recording_block_pos(const recording_reader_t* reader, uint32_t block) {
+    return reader->header.header_size + block * reader->header.block_size;
+}
+
+static inline bool recording_read_footer(recording_reader_t* reader, lfs_off_t size) {
+    recording_footer_t* footer = &reader->footer;
+
+    if (size < reader->header.header_size + sizeof(*footer) ||
+        !recording_read_at(reader, size - sizeof(*footer), footer, sizeof(*footer)) ||
+        footer->magic != RECORDING_FOOTER_MAGIC ||
+        recording_block_pos(reader, footer->blocks) + footer->entries * sizeof(uint32_t) + sizeof(*footer) != size) {
+        return false;
+    }
+
+    // The CRC runs over the entries and the footer, in one pass.
+    uint32_t crc = 0;
+    lfs_off_t pos = recording_block_pos(reader, footer->blocks);
+
+    while (pos < size - sizeof(uint32_t)) {
+        uint8_t chunk[64];
+        const lfs_size_t n = MIN(sizeof(chunk), size - sizeof(uint32_t) - pos);
+        if (!recording_read_at(reader, pos, chunk, n)) {
+            return false;
+        }
+        crc = recording_crc32_update(crc, chunk, n);
+        pos += n;
+    }
+
+    return crc == footer->crc;
+}
+
+static inline bool recording_reader_open(recording_reader_t* reader, lfs_t* lfs, const char* name, int flags) {
+    memset(reader, 0, sizeof(*reader));
+    reader->lfs = lfs;
+
+    if (lfs_file_open(lfs, &reader->file, name, flags) != LFS_ERR_OK) {
+        return false;
+    }
+
+    const lfs_ssize_t size = lfs_file_size(lfs, &reader->file);
+
+    if (size < 0 ||
+        !recording_read_at(reader, 0, &reader->header, sizeof(reader->header)) ||
+        !recording_header_valid(&reader->header)) {
+        lfs_file_close(lfs, &reader->file);
+        return false;
+    }
+
+    reader->indexed = recording_read_footer(reader, size);
+
+    if (reader->indexed) {
+        reader->blocks = reader->footer.blocks;
+    } else {
+        reader->blocks = (size - reader->header.header_size) / reader->header.block_size;
+        reader->tail = (size - reader->header.header_size) % reader->header.block_size;
+    }
+
+    return true;
+}
+
+static inline void recording_reader_close(recording_reader_t* reader) {
+    lfs_file_close(reader->lfs, &reader->file);
+}
+
+// Reads the raw bytes of a block, `reader->blocks` being the unfinished
+// one, into `reader->buffer`. Returns the bytes read.
+static inline uint32_t recording_read_raw(recording_reader_t* reader, uint32_t index) {
+    const uint32_t size = index < reader->blocks ? RECORDING_BLOCK_SIZE :
+                          index == reader->blocks ? reader->tail : 0;
+
+    if (size == 0 || !recording_read_at(reader, recording_block_pos(reader, index), &reader->buffer, size)) {
+        return 0;
+    }
+
+    return size;
+}
+
+// Reads and decodes a block, `reader->blocks` being the unfinished one.
+// Returns its samples, 0 for a block without any, or -1 for a damaged
+// block: a CRC, header or codec mismatch. The samples of the unfinished
+// block can't be checked, LittleFS only ever exposes what was synced.
+static inline int32_t recording_read_block(recording_reader_t* reader, uint32_t index, recording_samples_t* samples) {
+    const uint32_t size = recording_read_raw(reader, index);
+    const bool sealed = index < reader->blocks;
+    uint32_t end;
+
+    if (size < sizeof(recording_block_header_t)) {
+        return sealed ? -1 : 0;
+    }
+
+    if (sealed && reader->buffer.raw.trailer.crc != recording_crc32(&reader->buffer, offsetof(recording_block_t, trailer.crc))) {
+        return -1;
+    }
+
+    return recording_decode(&reader->buffer, size, sealed, reader->header.period_us, samples, &end);
+}
+
+// The last block starting at or before `offset_us` after the first sample,
+// the one holding the sample of that time. With the footer, one index entry
+// and the few block headers of its interval are read. Without, a binary
+// search on the block headers. A damaged block stops the search early.
+static inline uint32_t recording_find_block(recording_reader_t* reader, uint64_t offset_us) {
+    const uint32_t blocks = reader->blocks + (reader->tail >= sizeof(recording_block_header_t));
+    recording_block_header_t header;
+
+    if (blocks == 0 || !recording_read_at(reader, recording_block_pos(reader, 0), &header, sizeof(header))) {
+        return 0;
+    }
+
+    const uint64_t start_us = header.timestamp_us;
+    uint32_t low = 0;
+    uint32_t high = blocks - 1;
+
+    if (reader->indexed && reader->footer.entries) {
+        const recording_footer_t* footer = &reader->footer;
+        const uint32_t entry = MIN(offset_us / 1000 / footer->interval_ms, footer->entries - 1);
+
+        if (recording_read_at(reader, recording_block_pos(reader, footer->blocks) + entry * sizeof(uint32_t),
+                              &low, sizeof(low))) {
+            low = MIN(low, high);
+
+            // Blocks are scanned forward from the entry.
+            while (low < high) {
+                if (!recording_read_at(reader, recording_block_pos(reader, low + 1), &header, sizeof(header)) ||
+                    !recording_block_magic_valid(header.magic) || header.timestamp_us - start_us > offset_us) {
+                    break;
+                }
+                low += 1;
+            }
+
+            return low;
+        }
+
+        low = 0;
+    }
+
+    while (low < high) {
+        const uint32_t mid = low + (high - low + 1) / 2;
+
+        if (!recording_read_at(reader, recording_block_pos(reader, mid), &header, sizeof(header)) ||
+            !recording_block_magic_valid(header.magic)) {
+            return low;
+        }
+
+        if (header.timestamp_us - start_us <= offset_us) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    return low;
+}
+
+// Seals the unfinished block and appends the index, so the recording of a
+// previous boot seeks in O(1). Finalized recordings are left as they are.
+static inline bool recording_finalize(lfs_t* lfs, const char* name) {
+    recording_reader_t reader;
+    if (!recording_reader_open(&reader, lfs, name, LFS_O_RDWR)) {
+        return false;
+    }
+
+    if (reader.indexed) {
+        recording_reader_close(&reader);
+        return true;
+    }
+
+    static recording_samples_t block;
+    bool ok = true;
+
+    // Whole samples of the unfinished block are kept, a torn one is cut.
+    if (reader.tail) {
+        const lfs_off_t pos = recording_block_pos(&reader, reader.blocks);
+        const uint32_t size = recording_read_raw(&reader, reader.blocks);
+        uint32_t end = 0;
+
+        const int32_t count = size >= sizeof(recording_block_header_t) ?
+            recording_decode(&reader.buffer, size, false, reader.header.period_us, &block, &end) : 0;
+
+        if (count > 0) {
+            memset(reader.buffer.bytes + end, 0, RECORDING_BLOCK_SIZE - end);
+            recording_seal_block(&reader.buffer, count);
+
+            ok = lfs_file_seek(lfs, &reader.file, pos, LFS_SEEK_SET) >= 0 &&
+                 lfs_file_write(lfs, &reader.file, &reader.buffer, RECORDING_BLOCK_SIZE) == RECORDING_BLOCK_SIZE;
+            reader.blocks += 1;
+        } else {
+            ok = lfs_file_truncate(lfs, &reader.file, pos) == LFS_ERR_OK;
+        }
+
+        reader.tail = 0;
+    }
+
+    recording_footer_t footer = {
+        .magic = RECORDING_FOOTER_MAGIC,
+        .blocks = reader.blocks,
+        .interval_ms = RECORDING_INDEX_INTERVAL_MS,
+    };
+
+    // Entries are written at the end of the file between block reads, a
+    // chunk at a time.
+    const lfs_off_t end = recording_block_pos(&reader, reader.blocks);
+    const uint64_t interval_us = (uint64_t)RECORDING_INDEX_INTERVAL_MS * 1000;
+
+    uint32_t entries[32];
+    uint32_t pending = 0;
+    uint32_t crc = 0;
+    uint64_t last_us = 0;
+
+    for (uint32_t b = 0; ok && b <= reader.blocks; b++) {
+        const bool done = b == reader.blocks;
+        const int32_t count = done ? 0 : recording_read_block(&reader, b, &block);
+
+        if (count > 0) {
+            if (footer.samples == 0) {
+                footer.start_us = block.header.timestamp_us;
+            }
+            footer.samples += count;
+        }
+
+        // Entries up to this block's start point to the previous block, the
+        // last block takes the ones up to its last sample.
+        if (footer.samples) {
+            const uint64_t until_us = count > 0 ? block.header.timestamp_us - footer.start_us : last_us + 1;
+
+            while (footer.entries * interval_us < until_us) {
+                entries[pending++] = b ? b - 1 : 0;
+                footer.entries += 1;
+
+                if (pending == sizeof(entries) / sizeof(entries[0])) {
+                    crc = recording_crc32_update(crc, entries, sizeof(entries));
+                    ok = lfs_file_seek(lfs, &reader.file, 0, LFS_SEEK_END) >= 0 &&
+                         lfs_file_write(lfs, &reader.file, entries, sizeof(entries)) == sizeof(entries);
+                    pending = 0;
+                }
+            }
+        }
+
+        if (count > 0) {
+            last_us = block.header.timestamp_us + block.samples[count - 1].offset_us - footer.start_us;
+        }
+    }
+
+    if (ok) {
+        crc = recording_crc32_update(crc, entries, pending * sizeof(uint32_t));
+        footer.crc = recording_crc32_update(crc, &footer, offsetof(recording_footer_t, crc));
+
+        ok = lfs_file_seek(lfs, &reader.file, 0, LFS_SEEK_END) >= 0 &&
+             lfs_file_write(lfs, &reader.file, entries, pending * sizeof(uint32_t)) == (lfs_ssize_t)(pending * sizeof(uint32_t)) &&
+             lfs_file_write(lfs, &reader.file, &footer, sizeof(footer)) == sizeof(footer);
+    }
+
+    // The index must follow the last block.
+    ok = ok && lfs_file_size(lfs, &reader.file) == (lfs_ssize_t)(end + footer.entries * sizeof(uint32_t) + sizeof(footer));
+
+    lfs_file_close(lfs, &reader.file);
+
+    return ok;
+}
+
+#endif
@@ -0,0 +1,233 @@
+import struct
+import sys
+import zlib
+
+# Reader of the altimeter recording format, see recording.h.
+#
+#   python3 recording.py REC_003.bin [seconds]
+#
+# Prints the header, the blocks and the sample at the given time. Recordings
+# from before the format, headerless temperature and pressure pairs, load as
+# 4 Hz samples without timestamps. Both raw and packed blocks are decoded.
+
+MAGIC = 0x52544C41
+BLOCK_MAGIC = 0x4B4C4252
+PACKED_MAGIC = 0x5A4C4252
+FOOTER_MAGIC = 0x58444952
+VERSIONS = (1, 2)
+
+HEADER = struct.Struct("<IHHHBBIII")
+BLOCK_HEADER = struct.Struct("<IIQ")
+SAMPLE = struct.Struct("<Iff")
+PACKED_BASE = struct.Struct("<ii")
+TRAILER = struct.Struct("<II")
+FOOTER = struct.Struct("<IIIIQII")
+
+SENSORS = {1: "BMP390"}
+LEGACY_PERIOD_US = 250000
+
+TEMPERATURE_STEP = 0.01
+PRESSURE_STEP = 0.01
+
+
+def varints(data, pos):
+    """Yields (zig-zag decoded value, position after it) until the data runs out."""
+    while True:
+        value, shift = 0, 0
+        while True:
+            if pos >= len(data) or shift >= 35:
+                return
+            byte = data[pos]
+            pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        yield (value >> 1) ^ -(value & 1), pos
+
+
+def unpack(block, count, period_us):
+    """Samples of a packed block, `count` None for an unfinished one."""
+    temperature, pressure = PACKED_BASE.unpack_from(block, BLOCK_HEADER.size)
+    start = BLOCK_HEADER.size + PACKED_BASE.size
+    data = block[start:len(block) - (TRAILER.size if count is not None else 0)]
+
+    offset_us = 0
+    samples = [(0, temperature * TEMPERATURE_STEP, pressure * PRESSURE_STEP)]
+    fields = []
+
+    for value, _ in varints(data, 0):
+        if count is not None and len(samples) >= count:
+            break
+        fields.append(value)
+        if len(fields) == 3:
+            offset_us += period_us + fields[0]
+            temperature += fields[1]
+            pressure += fields[2]
+            samples.append((offset_us, temperature * TEMPERATURE_STEP, pressure * PRESSURE_STEP))
+            fields = []
+
+    if count is not None and len(samples) < count:
+        return None
+    return samples[:count] if count is not None else samples
+
+
+class Recording:
+    def __init__(self, data):
+        self.data = data
+        self.legacy = len(data) < HEADER.size or HEADER.unpack_from(data)[0] != MAGIC
+
+        if self.legacy:
+            self.sensor, self.oversampling, self.period_us, self.boot_count = 1, None, LEGACY_PERIOD_US, None
+            self.blocks, self.tail, self.index = 0, 0, None
+            return
+
+        (_, version, self.header_size, self.block_size, self.sensor, self.oversampling,
+         self.period_us, self.boot_count, crc) = HEADER.unpack_from(data)
+
+        if version not in VERSIONS or crc != zlib.crc32(data[:HEADER.size - 4]):
+            raise ValueError("unsupported or damaged header")
+
+        self.capacity = (self.block_size - BLOCK_HEADER.size - TRAILER.size) // SAMPLE.size
+        self.index = self._footer()
+
+        if self.index:
+            self.blocks, self.tail = self.index["blocks"], 0
+        else:
+            self.blocks, self.tail = divmod(len(data) - self.header_size, self.block_size)
+
+    def _footer(self):
+        if len(self.data) < self.header_size + FOOTER.size:
+            return None
+
+        magic, blocks, interval_ms, entries, start_us, samples, crc = FOOTER.unpack_from(self.data, len(self.data) - FOOTER.size)
+        start = self.header_size + blocks * self.block_size
+
+        if magic != FOOTER_MAGIC or start + entries * 4 + FOOTER.size != len(self.data):
+            return None
+        if crc != zlib.crc32(self.data[start:len(self.data) - 4]):
+            return None
+
+        return {
+            "blocks": blocks,
+            "interval_ms": interval_ms,
+            "entries": struct.unpack_from(f"<{entries}I", self.data, start),
+            "start_us": start_us,
+            "samples": samples,
+        }
+
+    def block(self, n):
+        """Returns (first_index, timestamp_us, samples), or None for a damaged block."""
+        pos = self.header_size + n * self.block_size
+
+        if n < self.blocks:
+            block = self.data[pos:pos + self.block_size]
+            count, crc = TRAILER.unpack_from(block, self.block_size - TRAILER.size)
+            if crc != zlib.crc32(block[:-4]):
+                return None
+        elif n == self.blocks and self.tail >= BLOCK_HEADER.size:
+            # The unfinished block has no trailer to check.
+            block = self.data[pos:pos + self.tail]
+            count = None
+        else:
+            return None
+
+        magic, first_index, timestamp_us = BLOCK_HEADER.unpack_from(block)
+
+        if magic == BLOCK_MAGIC:
+            if count is None:
+                count = (len(block) - BLOCK_HEADER.size) // SAMPLE.size
+            if count > self.capacity:
+                return None
+            samples = [SAMPLE.unpack_from(block, BLOCK_HEADER.size + i * SAMPLE.size) for i in range(count)]
+        elif magic == PACKED_MAGIC:
+            if count == 0 or len(block) < BLOCK_HEADER.size + PACKED_BASE.size:
+                samples = []
+            else:
+                samples = unpack(block, count, self.period_us)
+        else:
+            return None
+
+        return None if samples is None else (first_index, timestamp_us, samples)
+
+    def samples(self):
+        """Yields (index, seconds since the first sample, temperature, pressure)."""
+        if self.legacy:
+            for i, (temperature, pressure) in enumerate(struct.iter_unpack("<ff", self.data[:len(self.data) // 8 * 8])):
+                yield i, i * self.period_us / 1e6, temperature, pressure
+            return
+
+        start_us = None
+        for n in range(self.blocks + 1):
+            block = self.block(n)
+            if block is None:
+                continue
+
+            first_index, timestamp_us, samples = block
+            for i, (offset_us, temperature, pressure) in enumerate(samples):
+                start_us = timestamp_us if start_us is None else start_us
+                yield first_index + i, (timestamp_us + offset_us - start_us) / 1e6, temperature, pressure
+
+    def damaged(self):
+        return [n for n in range(self.blocks) if self.block(n) is None]
+
+    def find_block(self, seconds):
+        """The last block starting at or before the time, through the index when present."""
+        first = self.block(0)
+        if first is None:
+            return 0
+
+        offset_us = seconds * 1e6
+        low, high = 0, self.blocks - 1 + (self.tail >= BLOCK_HEADER.size)
+
+        if self.index and self.index["entries"]:
+            entries = self.index["entries"]
+            low = min(entries[min(int(offset_us // 1000 // self.index["interval_ms"]), len(entries) - 1)], high)
+            while low < high:
+                block = self.block(low + 1)
+                if block is None or block[1] - first[1] > offset_us:
+                    break
+                low += 1
+            return low
+
+        while low < high:
+            mid = (low + high + 1) // 2
+            block = self.block(mid)
+            if block is None:
+                return low
+            if block[1] - first[1] <= offset_us:
+                low = mid
+            else:
+                high = mid - 1
+        return low
+
+
+def load(path):
+    with open(path, "rb") as f:
+        return Recording(f.read())
+
+
+def main(path, seconds=None):
+    rec = load(path)
+
+    if rec.legacy:
+        print(f"{path}: legacy recording, {len(rec.data) // 8} samples")
+        return
+
+    print(f"{path}: recording #{rec.boot_count}, {SENSORS.get(rec.sensor, rec.sensor)} oversampling {rec.oversampling}, "
+          f"period {rec.period_us / 1000:.0f} ms")
+
+    samples = list(rec.samples())
+    duration = samples[-1][1] if samples else 0
+    print(f"{rec.blocks} blocks of {rec.block_size} bytes, {rec.tail} bytes unfinished, "
+          f"{len(samples)} samples over {duration:.2f} s, damaged blocks: {rec.damaged() or 'none'}, "
+          f"index: {'yes' if rec.index else 'no'}")
+
+    if seconds is not None:
+        n = rec.find_block(float(seconds))
+        first_index, timestamp_us, block = rec.block(n)
+        print(f"{seconds} s is in block {n}, samples {first_index} to {first_index + len(block) - 1}")
+
+
+if __name__ == "__main__":
+    main(*sys.argv[1:])
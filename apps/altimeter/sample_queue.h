@@ -0,0 +1,78 @@
+#ifndef SAMPLE_QUEUE_H
+#define SAMPLE_QUEUE_H
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+// Lock-free single-producer single-consumer queue between the cores: core0
+// pushes samples, core1 pops them. Each index is only written by one side
+// and the barriers order the slot against the index that publishes it.
+
+#ifndef SAMPLE_QUEUE_SIZE
+#define SAMPLE_QUEUE_SIZE 64    // Power of two. 16 s of samples at 4 Hz.
+#endif
+
+typedef struct {
+    uint64_t timestamp_us;      // When the sample was due.
+    uint32_t index;
+    float temperature;
+    float pressure;
+} sample_t;
+
+typedef struct {
+    sample_t items[SAMPLE_QUEUE_SIZE];
+    volatile uint32_t head;     // Written by the producer.
+    volatile uint32_t tail;     // Written by the consumer.
+
+    // Producer side.
+    volatile uint32_t pushed;
+    volatile uint32_t overruns;
+    volatile uint32_t peak_depth;
+} sample_queue_t;
+
+// Producer. A full queue drops the new sample and counts an overrun.
+static inline bool sample_queue_push(sample_queue_t* queue, const sample_t* sample) {
+    const uint32_t head = queue->head;
+    const uint32_t depth = head - queue->tail;
+
+    if (depth == SAMPLE_QUEUE_SIZE) {
+        queue->overruns += 1;
+        return false;
+    }
+
+    queue->items[head % SAMPLE_QUEUE_SIZE] = *sample;
+    __dmb();
+    queue->head = head + 1;
+
+    queue->pushed += 1;
+    if (depth + 1 > queue->peak_depth) {
+        queue->peak_depth = depth + 1;
+    }
+
+    // Wakes the consumer from __wfe().
+    __sev();
+
+    return true;
+}
+
+// Consumer.
+static inline bool sample_queue_pop(sample_queue_t* queue, sample_t* sample) {
+    const uint32_t tail = queue->tail;
+
+    if (tail == queue->head) {
+        return false;
+    }
+
+    __dmb();
+    *sample = queue->items[tail % SAMPLE_QUEUE_SIZE];
+    __dmb();
+    queue->tail = tail + 1;
+
+    return true;
+}
+
+static inline uint32_t sample_queue_depth(const sample_queue_t* queue) {
+    return queue->head - queue->tail;
+}
+
+#endif
@@ -3,10 +3,31 @@
 
 #include "pico/stdio.h"
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#endif
+#if LIB_PICO_STDIO_UART
+#include "pico/stdio_uart.h"
+#endif
 
 #include <lfs_rp2040.h>
 #include <bmp390.h>
 
+#include "download.h"
+#include "recording.h"
+#include "sample_queue.h"
+
+#ifdef ALTIMETER_NET
+#include "download_net.h"
+#endif
+
+// Pre-erased blocks kept ahead of the recording. At about 70 packed samples
+// per 256 byte block and 4 samples per second a flash block lasts around
+// five minutes, 4 blocks also cover the metadata compactions in between.
+#define POOL_TARGET 4
+
 static lfs_t lfs;
 static struct lfs_config cfg;
 
@@ -32,16 +53,73 @@ void reset_recordings() {
     lfs_mount(&lfs, &cfg);
 }
 
-void start_altimeter_mode() {
-    uint32_t boot_count = read_boot_count(true);
-    printf("Current recoding index: %d\n", boot_count);
+// Sampling runs on core0 from a fixed-period timer, storage on core1. The
+// queue absorbs the flash stalls, so they never delay a reading.
+#define SAMPLE_PERIOD_MS 250
 
-    char filename[64] = {0};
-    sprintf(filename, "REC_%03d", boot_count);
-    printf("Creating recording file: %s\n", filename);
-    lfs_file_t recording_file;
-    lfs_file_open(&lfs, &recording_file, filename, LFS_O_RDWR | LFS_O_CREAT);
+static recording_t recording;
+static sample_queue_t queue;
+
+static struct repeating_timer sample_timer;
+static volatile uint64_t sample_due_us;
+static volatile uint32_t sample_ticks;
+
+static volatile uint32_t jitter_max_us;
+static volatile uint32_t read_max_us;
+
+static bool sample_timer_callback(struct repeating_timer *t) {
+    sample_due_us = time_us_64();
+    sample_ticks += 1;
+    return true;
+}
+
+// Core1: drains the queue to the recording, prints and erases ahead.
+static void storage_main() {
+    uint32_t write_max_us = 0;
+    lfs_rp2040_pool_reset_stats();
+
+    while (true) {
+        sample_t sample;
+
+        if (!sample_queue_pop(&queue, &sample)) {
+            // Erase ahead while there is nothing to store. The budget of a
+            // whole flash block lets a free 64 KB block go in one erase; the
+            // queue holds the samples taken meanwhile.
+            lfs_rp2040_pool_stats_t pool;
+            lfs_rp2040_pool_get_stats(&pool);
+            if (pool.erased < POOL_TARGET) {
+                lfs_rp2040_pool_fill(&lfs, FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE);
+                continue;
+            }
+
+            __wfe();
+            continue;
+        }
 
+        const uint32_t start_us = time_us_32();
+        recording_append(&recording, sample.timestamp_us, sample.index, sample.temperature, sample.pressure);
+
+        const uint32_t write_us = time_us_32() - start_us;
+        if (write_us > write_max_us) {
+            write_max_us = write_us;
+        }
+
+        lfs_rp2040_pool_stats_t pool;
+        lfs_rp2040_pool_get_stats(&pool);
+
+        printf("---------------------------------------------\n");
+        printf("Sample #%u at %llu ms\n", sample.index, sample.timestamp_us / 1000);
+        printf("Temperature (ºC): %f\n", sample.temperature);
+        printf("Pressure (hPa): %f\n", sample.pressure);
+        printf("Write (us): %u, max %u, writes %u, syncs %u, pool %u, hits %u, misses %u\n",
+               write_us, write_max_us, recording.recorder.writes, recording.recorder.syncs, pool.erased, pool.hits, pool.misses);
+        printf("Queue: depth %u, peak %u, overruns %u, jitter max %u us, read max %u us\n",
+               sample_queue_depth(&queue), queue.peak_depth, queue.overruns, jitter_max_us, read_max_us);
+    }
+}
+
+// Returns only when the sensor or the recording can't be started.
+void start_altimeter_mode() {
     bmp_t bmp;
     bmp.oss = 5;
     bmp.i2c.addr = 0x77;
@@ -50,54 +128,281 @@ void start_altimeter_mode() {
     bmp.i2c.scl = 3;
     bmp.i2c.sda = 2;
 
+    // The sensor first, a failure leaves no open file and no used index.
     printf("Starting BMP390...\n");
     if (!bmp_init(&bmp)) {
+        printf("BMP390 not found.\n");
         return;
     }
 
-    while(true) {
+    uint32_t boot_count = read_boot_count(true);
+    printf("Current recoding index: %d\n", boot_count);
+
+    char filename[64] = {0};
+
+    // The previous boot never closed its recording: seal it and add its
+    // index. Recordings from before the format are left as they are.
+    sprintf(filename, "REC_%03d", boot_count - 1);
+    if (recording_finalize(&lfs, filename)) {
+        printf("Finalized recording file: %s\n", filename);
+    }
+
+    const recording_header_t info = {
+        .sensor = RECORDING_SENSOR_BMP390,
+        .oversampling = bmp.oss,
+        .period_us = SAMPLE_PERIOD_MS * 1000,
+        .boot_count = boot_count,
+    };
+
+    sprintf(filename, "REC_%03d", boot_count);
+    printf("Creating recording file: %s\n", filename);
+    if (!recording_open(&recording, &lfs, filename, &info, RECORDING_CODEC_PACKED, RECORDER_SYNC_INTERVAL_MS)) {
+        return;
+    }
+
+    // Core0 isn't a lockout victim: the binary runs from RAM, so it keeps
+    // sampling while core1 programs and erases the flash.
+    multicore_launch_core1(storage_main);
+
+    // Negative: the period runs from one callback to the next.
+    add_repeating_timer_ms(-SAMPLE_PERIOD_MS, sample_timer_callback, NULL, &sample_timer);
+
+    uint32_t serviced = 0;
+
+    while (true) {
+        while (sample_ticks == serviced) {
+            __wfe();
+        }
+
+        const uint32_t ints = save_and_disable_interrupts();
+        const uint32_t ticks = sample_ticks;
+        const uint64_t due_us = sample_due_us;
+        restore_interrupts(ints);
+
+        // Ticks that fired while the previous read ran get no sample, they
+        // are overruns like the samples a full queue drops. Sample numbers
+        // follow the ticks, so the gap is visible in the recording.
+        queue.overruns += ticks - serviced - 1;
+        serviced = ticks;
+
+        const uint32_t index = ticks - 1;
+        const uint64_t start_us = time_us_64();
+
+        if (start_us - due_us > jitter_max_us) {
+            jitter_max_us = start_us - due_us;
+        }
+
         if (!bmp_get_pressure_temperature(&bmp)) {
             continue;
         }
 
-        printf("---------------------------------------------\n");
-        printf("Temperature (ºC): %f\n", bmp.temperature);
-        printf("Pressure (hPa): %f\n", bmp.pressure);
-        printf("Altitude (m): %f\n", bmp.altitude);
+        const uint32_t read_us = time_us_64() - start_us;
+        if (read_us > read_max_us) {
+            read_max_us = read_us;
+        }
 
-        lfs_file_write(&lfs, &recording_file, &bmp.temperature, sizeof(float));
-        lfs_file_write(&lfs, &recording_file, &bmp.pressure, sizeof(float));
-        lfs_file_sync(&lfs, &recording_file);
+        const sample_t sample = {
+            .timestamp_us = due_us,
+            .index = index,
+            .temperature = bmp.temperature,
+            .pressure = bmp.pressure,
+        };
 
-        sleep_ms(250);
+        sample_queue_push(&queue, &sample);
     }
+}
 
-    lfs_file_close(&lfs, &recording_file);
+static void print_hex(const uint8_t* data, uint32_t size) {
+    static const char digits[] = "0123456789ABCDEF";
+    char line[129];
+
+    while (size) {
+        const uint32_t n = MIN(size, (sizeof(line) - 1) / 2);
+
+        for (uint32_t i = 0; i < n; i++) {
+            line[i * 2] = digits[data[i] >> 4];
+            line[i * 2 + 1] = digits[data[i] & 0xF];
+        }
+        line[n * 2] = '\0';
+        fputs(line, stdout);
+
+        data += n;
+        size -= n;
+    }
 }
 
 void dump_recording_file(uint32_t index) {
-    printf("<======");
-
     char filename[64] = {0};
     sprintf(filename, "REC_%03d", index);
 
     lfs_file_t recording_file;
-    lfs_file_open(&lfs, &recording_file, filename, LFS_O_RDWR);
+    if (lfs_file_open(&lfs, &recording_file, filename, LFS_O_RDONLY)) {
+        printf("Recording not found.\n");
+        return;
+    }
+
+    const int32_t file_size = lfs_file_size(&lfs, &recording_file);
+    const uint32_t start_us = time_us_32();
 
-    int32_t file_size = lfs_file_size(&lfs, &recording_file);
+    printf("<======");
+
+    // Straight from the flash, a small file stored inline falls back to reads.
+    for (int32_t pos = 0; pos < file_size;) {
+        const uint8_t* data;
+        lfs_size_t size;
+
+        if (lfs_rp2040_file_span(&lfs, &recording_file, pos, &data, &size) == LFS_ERR_OK) {
+            print_hex(data, size);
+            pos += size;
+            continue;
+        }
 
-    uint8_t read_buffer[128];
-    for (int32_t seek = 0; seek < file_size; seek += sizeof(read_buffer)) {
-        lfs_file_read(&lfs, &recording_file, read_buffer, sizeof(read_buffer));
-        
-        for (int32_t i = 0; i < sizeof(read_buffer); i++) {
-            printf("%02X", read_buffer[i]);
+        uint8_t read_buffer[128];
+        lfs_file_seek(&lfs, &recording_file, pos, LFS_SEEK_SET);
+        const lfs_ssize_t n = lfs_file_read(&lfs, &recording_file, read_buffer, sizeof(read_buffer));
+        if (n <= 0) {
+            break;
         }
+
+        print_hex(read_buffer, n);
+        pos += n;
     }
 
+    printf("======>\n");
+
     lfs_file_close(&lfs, &recording_file);
 
-    printf("======>\n");
+    printf("Dumped %d bytes in %u ms.\n", file_size, (time_us_32() - start_us) / 1000);
+}
+
+void print_recording_info(uint32_t index) {
+    char filename[64] = {0};
+    sprintf(filename, "REC_%03d", index);
+
+    recording_reader_t reader;
+    if (!recording_reader_open(&reader, &lfs, filename, LFS_O_RDONLY)) {
+        printf("Recording not found or not in the recording format.\n");
+        return;
+    }
+
+    printf("Recording #%u: sensor %u, oversampling %u, period %u us\n",
+           reader.header.boot_count, reader.header.sensor, reader.header.oversampling, reader.header.period_us);
+
+    static recording_samples_t block;
+    uint32_t samples = 0;
+    uint32_t damaged = 0;
+    uint64_t first_us = 0;
+    uint64_t last_us = 0;
+
+    for (uint32_t b = 0; b <= reader.blocks; b++) {
+        const int32_t count = recording_read_block(&reader, b, &block);
+
+        if (count < 0) {
+            damaged += 1;
+            continue;
+        }
+
+        if (count > 0) {
+            first_us = samples ? first_us : block.header.timestamp_us;
+            last_us = block.header.timestamp_us + block.samples[count - 1].offset_us;
+            samples += count;
+        }
+    }
+
+    printf("%u blocks, %u damaged, %u bytes unfinished, %u samples over %llu ms, index: %s\n",
+           reader.blocks, damaged, reader.tail, samples, (last_us - first_us) / 1000, reader.indexed ? "yes" : "no");
+
+    recording_reader_close(&reader);
+}
+
+// Reads `size` bytes from stdio, false when the host goes quiet.
+static bool read_exact(void* data, uint32_t size, uint32_t timeout_us) {
+    uint8_t* bytes = data;
+
+    for (uint32_t i = 0; i < size; i++) {
+        const int c = getchar_timeout_us(timeout_us);
+        if (c == PICO_ERROR_TIMEOUT) {
+            return false;
+        }
+        bytes[i] = c;
+    }
+
+    return true;
+}
+
+static void set_stdio_binary(bool binary) {
+#if LIB_PICO_STDIO_USB
+    stdio_set_translate_crlf(&stdio_usb, !binary);
+#endif
+#if LIB_PICO_STDIO_UART
+    stdio_set_translate_crlf(&stdio_uart, !binary);
+#endif
+}
+
+// Serves one request of download.h, sent by the host right after 'B'.
+void serve_download() {
+    static download_t download;
+    download_request_t req;
+
+    if (!read_exact(&req, sizeof(req), 1000000) || req.magic != DOWNLOAD_REQUEST_MAGIC) {
+        printf("Invalid download request.\n");
+        return;
+    }
+
+    set_stdio_binary(true);
+
+    const download_reply_t reply = download_open(&download, &lfs, &req);
+    fwrite(&reply, sizeof(reply), 1, stdout);
+
+    download_frame_t frame;
+    const uint8_t* data;
+
+    while (reply.status == DOWNLOAD_OK && download_next(&download, &frame, &data)) {
+        fwrite(&frame, sizeof(frame), 1, stdout);
+        fwrite(data, frame.size, 1, stdout);
+
+        // The host sends a byte to stop, before requesting again.
+        if (getchar_timeout_us(0) != PICO_ERROR_TIMEOUT) {
+            break;
+        }
+    }
+
+    fflush(stdout);
+    download_close(&download);
+
+    set_stdio_binary(false);
+}
+
+static void print_op_stats(const char* name, const lfs_rp2040_op_stats_t* op) {
+    printf("    %-5s: %u calls, %llu bytes, %u flash ops, irq off %llu us (max %u us)\n",
+           name, op->calls, op->bytes, op->flash_ops, op->irq_off_us, op->irq_off_max_us);
+}
+
+void print_storage_stats() {
+    lfs_rp2040_io_stats_t io;
+    lfs_rp2040_get_io_stats(&io);
+
+    printf("Storage I/O since boot:\n");
+    print_op_stats("read", &io.read);
+    print_op_stats("prog", &io.prog);
+    print_op_stats("erase", &io.erase);
+    printf("    sync : %u calls\n", io.syncs);
+
+    uint32_t erased_blocks = 0;
+    uint32_t max_erases = 0;
+    lfs_block_t max_block = 0;
+
+    for (lfs_block_t block = 0; block < cfg.block_count; block++) {
+        const uint32_t erases = lfs_rp2040_get_erase_count(block);
+        erased_blocks += erases > 0;
+        if (erases > max_erases) {
+            max_erases = erases;
+            max_block = block;
+        }
+    }
+
+    printf("Wear: %u/%u blocks erased, most erased block %u (%u times)\n",
+           erased_blocks, cfg.block_count, max_block, max_erases);
 }
 
 int main(void) {
@@ -108,7 +413,12 @@ int main(void) {
     printf("Hello from Pi Pico!\n");
 
     printf("Checking hardware capabilities...\n");
-    lfs_rp2040_init(&cfg);
+    // The binary runs from RAM, core0 keeps sampling while core1 writes.
+    lfs_rp2040_allow_unlocked_flash(true);
+    if (!lfs_rp2040_init(&cfg)) {
+        printf("Flash not available.\n");
+        return 1;
+    }
 
     printf("Mounting filesystem...\n");
     if (lfs_mount(&lfs, &cfg)) {
@@ -120,21 +430,43 @@ int main(void) {
     printf("Automatically starting altimeter in 5 seconds...\n");
     printf("Press 'X' to enter in CLI mode.\n");
 
-    int elapsed = 0;
+#ifdef ALTIMETER_NET
+    // The USB port is a network interface, connecting to the download port
+    // also enters the CLI mode.
+    network_init();
+    download_net_init(&lfs);
+
+    int iteration_time = 1;
+#else
     int iteration_time = 50;
+#endif
+
+    int elapsed = 0;
     while (getchar_timeout_us(0) != 'X') {
+#ifdef ALTIMETER_NET
+        network_step();
+        if (download_net.pcb) {
+            break;
+        }
+#endif
+
         sleep_ms(iteration_time);
         elapsed += iteration_time;
 
+        // Recording doesn't come back, unless it failed: fall back to the CLI.
         if (elapsed >= 5000) {
             start_altimeter_mode();
+            break;
         }
     }
 
     printf("Available recordings: %d\n", read_boot_count(false));
     printf("Commands:\n");
     printf("    D - Dump recording file.\n");
+    printf("    B - Binary download, see download.py.\n");
     printf("    + - Reset recording counter.\n");
+    printf("    I - Print recording info.\n");
+    printf("    S - Print storage I/O stats.\n");
 
     uint32_t index;
 
@@ -155,14 +487,39 @@ int main(void) {
                 dump_recording_file(index);
                 break;
 
+            case 'B':
+                serve_download();
+                break;
+
             case '+':
+#ifdef ALTIMETER_NET
+                // Payloads in flight point into the flash that is formatted.
+                if (download_net.pcb) {
+                    printf("A download is running, close it first.\n");
+                    break;
+                }
+#endif
                 printf("Reseting recordings...\n");
                 reset_recordings();
                 printf("Done! Available recordings: %d\n", read_boot_count(false));
                 break;
 
+            case 'I':
+                printf("Type the recording index.\n");
+                scanf("%d", &index);
+                print_recording_info(index);
+                break;
+
+            case 'S':
+                print_storage_stats();
+                break;
+
             default: 
+#ifdef ALTIMETER_NET
+                network_step();
+#else
                 sleep_ms(30);
+#endif
                 break;
         }
     }
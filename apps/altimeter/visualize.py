@@ -1,16 +1,23 @@
+import sys
+
 import numpy as np 
 import matplotlib.pyplot as plt
 from matplotlib.ticker import FormatStrFormatter
 
+import recording
+
 # Convert HEX file to BIN.
 # cat D4.hex | xxd -r -p > D4.bin
-# Checkout example_data for data examples.
-
-data = np.fromfile('./D5.bin', dtype=np.float32)
-temp_x = data[0::2]
-pres_x = data[1::2]
+# Checkout example_data for data examples, recorded before the format.
+#
+#   python3 visualize.py [D5.bin]
+
+rec = recording.load(sys.argv[1] if len(sys.argv) > 1 else './D5.bin')
+data = np.array([sample[1:] for sample in rec.samples()], dtype=np.float64)
+y = data[:, 0]
+temp_x = data[:, 1]
+pres_x = data[:, 2]
 alt_x = ((((1013.25 / pres_x) ** (1/5.257)) - 1) * (temp_x + 273.15)) / 0.0065
-y = np.linspace(0, len(temp_x) / 4, len(temp_x)) 
 max_alt_del = np.max(alt_x) - np.min(alt_x)
 
 fig = plt.figure()
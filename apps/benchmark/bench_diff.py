@@ -0,0 +1,78 @@
+import sys
+
+# Compares two benchmark reports captured from the UART and fails when a
+# benchmark got slower than the threshold.
+#
+#   cat /dev/ttyUSB0 > new.txt
+#   python3 bench_diff.py base.txt new.txt [threshold_percent]
+#
+# Exits with 1 when any median or p99 regressed more than the threshold (5 %).
+
+FIELDS = ("count", "min", "median", "p99", "max", "bytes")
+
+
+def load(path):
+    results = {}
+    clock = None
+
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+
+            if line.startswith("# bench"):
+                for token in line.split()[2:]:
+                    key, _, value = token.partition("=")
+                    if key == "clk_sys_mhz":
+                        clock = int(value)
+
+            if line.startswith("bench,"):
+                parts = line.split(",")
+                results[parts[1]] = dict(zip(FIELDS, map(int, parts[2:])))
+
+    return clock, results
+
+
+def change(base, new):
+    return (new - base) * 100.0 / base if base else 0.0
+
+
+def main(base_path, new_path, threshold="5"):
+    threshold = float(threshold)
+    base_clock, base = load(base_path)
+    new_clock, new = load(new_path)
+
+    if base_clock != new_clock:
+        print(f"warning: clk_sys differs ({base_clock} MHz vs {new_clock} MHz)")
+
+    print(f"{'benchmark':<28} {'median':>10} {'new':>10} {'change':>8} {'p99':>10} {'new':>10} {'change':>8}  cycles/KB")
+
+    regressions = []
+
+    for name in sorted(set(base) | set(new)):
+        if name not in base or name not in new:
+            print(f"{name:<28} only in {'new' if name in new else 'base'}")
+            continue
+
+        b, n = base[name], new[name]
+        median = change(b["median"], n["median"])
+        p99 = change(b["p99"], n["p99"])
+        per_kb = f"{n['median'] * 1024 // n['bytes']}" if n["bytes"] else ""
+        flag = ""
+
+        if median > threshold or p99 > threshold:
+            regressions.append(name)
+            flag = "  <-- slower"
+
+        print(f"{name:<28} {b['median']:>10} {n['median']:>10} {median:>+7.1f}% "
+              f"{b['p99']:>10} {n['p99']:>10} {p99:>+7.1f}%  {per_kb}{flag}")
+
+    if regressions:
+        print(f"\n{len(regressions)} regression(s) over {threshold} %: {', '.join(regressions)}")
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print("usage: bench_diff.py base.txt new.txt [threshold_percent]")
+        sys.exit(2)
+    main(*sys.argv[1:])
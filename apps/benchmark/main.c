@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+#include "bench.h"
+#include "bmp390.h"
+#include "dma_sniff.h"
+#include "lfs_rp2040.h"
+#include "recording.h"
+#include "usb_network.h"
+
+#define ITERATIONS BENCH_MAX_SAMPLES
+#define FRAME_HEADER 54     // Ethernet + IPv4 + TCP.
+
+// Not declared by lwIP when LWIP_CHKSUM is overridden.
+u16_t lwip_standard_chksum(const void *dataptr, int len);
+
+bench_t bench;
+bench_t erase;
+
+uint8_t data[4096 + 4] __attribute__((aligned(4)));
+uint8_t frame[CFG_TUD_NET_MTU + 64];
+volatile uint32_t sink;
+
+// Interrupt latency: an alarm is armed to fire while the measured call runs.
+#define LATENCY_DELAY_US 10
+
+int latency_alarm;
+volatile uint64_t latency_fired;
+
+static void fill_data() {
+    for (uint i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+}
+
+static void bench_chksum(const char* name, uint16_t (*fn)(const void*, int), uint offset, int len) {
+    bench_reset(&bench, name, len);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        bench_begin(&bench);
+        sink = fn(data + offset, len);
+        bench_end(&bench);
+    }
+
+    bench_report(&bench);
+}
+
+static uint16_t chksum_m0(const void* data, int len) {
+    return usb_network_chksum(data, len);
+}
+
+static uint16_t chksum_lwip(const void* data, int len) {
+    return lwip_standard_chksum(data, len);
+}
+
+// Both checksums over every length of a frame payload at every alignment,
+// on random bytes and on 0xFF bytes, which carry on every add.
+static void check_chksum() {
+    uint32_t mismatches = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            memset(data, 0xFF, sizeof(data));
+        }
+
+        for (uint offset = 0; offset < 4; offset++) {
+            for (int len = 0; len <= 1500; len++) {
+                const uint16_t m0 = usb_network_chksum(data + offset, len);
+                const uint16_t lwip = lwip_standard_chksum(data + offset, len);
+
+                if (m0 != lwip) {
+                    if (mismatches < 8) {
+                        printf("# chksum_check: offset %u len %d: 0x%04x, lwIP 0x%04x\n", offset, len, m0, lwip);
+                    }
+                    mismatches += 1;
+                }
+            }
+        }
+    }
+
+    printf("# chksum_check: %s, %u mismatches\n", mismatches ? "FAILED" : "ok", mismatches);
+    fill_data();
+}
+
+static void bench_dma_sniff(const char* name, int len) {
+    dma_sniff_t sniff;
+
+    if (!dma_sniff_init(&sniff)) {
+        return;
+    }
+
+    bench_reset(&bench, name, len);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        bench_begin(&bench);
+        sink = dma_sniff_sum16(&sniff, data, len);
+        bench_end(&bench);
+    }
+
+    bench_report(&bench);
+
+    // run() repeats on every key press, the channel is claimed again.
+    dma_channel_unclaim(sniff.chan);
+}
+
+static void bench_xmit_cb() {
+    // A TCP segment as lwIP hands it to the driver: headers in RAM, payload by reference.
+    struct pbuf* header = pbuf_alloc(PBUF_RAW, FRAME_HEADER, PBUF_RAM);
+    struct pbuf* payload = pbuf_alloc(PBUF_RAW, TCP_MSS, PBUF_REF);
+
+    if (header == NULL || payload == NULL) {
+        return;
+    }
+
+    payload->payload = data;
+    pbuf_cat(header, payload);
+
+    bench_reset(&bench, "tud_network_xmit_cb_1514", header->tot_len);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        bench_begin(&bench);
+        sink = tud_network_xmit_cb(frame, header, 0);
+        bench_end(&bench);
+    }
+
+    bench_report(&bench);
+    pbuf_free(header);
+}
+
+static void bench_bmp_calibrate_pressure() {
+    // Typical BMP390 compensation parameters after bmp_get_calib().
+    bmp_t bmp = {
+        .calib_part = {
+            .T1 = 7.2e6, .T2 = 1.75e-5, .T3 = -2.56e-13,
+            .P1 = -1.6e-2, .P2 = -2.3e-5, .P3 = 1.2e-9, .P4 = 0.0,
+            .P5 = 1.7e5, .P6 = 3.8e2, .P7 = -3.5e-1, .P8 = 1.8e-4,
+            .P9 = 3.6e-11, .P10 = 2.2e-12, .P11 = -6.6e-19,
+        },
+    };
+
+    bench_reset(&bench, "bmp_calibrate_pressure", 0);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        bmp.temperature = 23.5f;
+        bmp.pressure = 6.5e6f + i;
+
+        bench_begin(&bench);
+        bmp_calibrate_pressure(&bmp);
+        bench_end(&bench);
+
+        sink = bmp.pressure;
+    }
+
+    bench_report(&bench);
+}
+
+// Altimeter samples 250 ms apart: a little timer jitter and sensor noise on
+// a slow climb.
+static void recording_sample(int i, uint64_t* timestamp_us, float* temperature, float* pressure) {
+    *timestamp_us = 1000000 + (uint64_t)i * 250000 + (rand() % 16);
+    *temperature = 21.5f + i * 0.002f + (rand() % 8) * 0.01f;
+    *pressure = 1013.25f - i * 0.03f + (rand() % 8) * 0.01f;
+}
+
+static void bench_recording_pack() {
+    static recording_packed_block_t block;
+    recording_packer_t packer;
+    uint64_t timestamp_us;
+    float temperature, pressure;
+
+    recording_sample(0, &timestamp_us, &temperature, &pressure);
+    recording_pack_first(&block, &packer, timestamp_us, temperature, pressure);
+
+    bench_reset(&bench, "recording_pack", 0);
+
+    for (int i = 1; i <= ITERATIONS; i++) {
+        recording_sample(i, &timestamp_us, &temperature, &pressure);
+
+        bench_begin(&bench);
+        uint32_t n = recording_pack(&block, &packer, 250000, timestamp_us, temperature, pressure);
+        bench_end(&bench);
+
+        // A full block starts over, like recording_append() does.
+        if (n == 0) {
+            recording_pack_first(&block, &packer, timestamp_us, temperature, pressure);
+        }
+
+        sink = n;
+    }
+
+    bench_report(&bench);
+}
+
+static void bench_recording_decode() {
+    static recording_buffer_t buffer;
+    static recording_samples_t samples;
+    recording_packer_t packer;
+    uint64_t timestamp_us;
+    float temperature, pressure;
+    uint32_t count = 1;
+    uint32_t end;
+
+    // A full block of samples, decoded as the readers do.
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.header.magic = RECORDING_PACKED_MAGIC;
+
+    recording_sample(0, &timestamp_us, &temperature, &pressure);
+    recording_pack_first(&buffer.packed, &packer, timestamp_us, temperature, pressure);
+
+    while (true) {
+        recording_sample(count, &timestamp_us, &temperature, &pressure);
+        if (!recording_pack(&buffer.packed, &packer, 250000, timestamp_us, temperature, pressure)) {
+            break;
+        }
+        count += 1;
+    }
+
+    recording_seal_block(&buffer, count);
+
+    bench_reset(&bench, "recording_decode_256", sizeof(buffer));
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        bench_begin(&bench);
+        sink = recording_decode(&buffer, sizeof(buffer), true, 250000, &samples, &end);
+        bench_end(&bench);
+    }
+
+    bench_report(&bench);
+}
+
+static void latency_irq(uint alarm) {
+    latency_fired = time_us_64();
+}
+
+static uint64_t latency_arm() {
+    uint64_t target;
+
+    latency_fired = 0;
+
+    // A missed target never fires, it's moved after the delay that made it late.
+    do {
+        target = time_us_64() + LATENCY_DELAY_US;
+    } while (hardware_alarm_set_target(latency_alarm, from_us_since_boot(target)));
+
+    return target;
+}
+
+static void latency_collect(bench_t* bench, uint64_t target) {
+    while (latency_fired == 0) {
+        tight_loop_contents();
+    }
+
+    bench_add(bench, (latency_fired - target) * bench_clk_mhz);
+}
+
+// The read before lfs_rp2040_read() kept the interrupts enabled: a memcpy
+// through the XIP cache with the interrupts off. The baseline of the reads.
+static void read_irq_off(void* buffer, const uint8_t* src, uint size) {
+    const uint32_t ints = save_and_disable_interrupts();
+    memcpy(buffer, src, size);
+    restore_interrupts(ints);
+}
+
+// Wake-to-service latency: the alarm calls network_wake() as an interrupt
+// handler that produces work would, and the loop runs until network_step()
+// has serviced it, polling or sleeping in network_wait() in between.
+static void wake_irq(uint alarm) {
+    network_wake();
+}
+
+static void bench_wake_latency(const char* name, bool event) {
+    hardware_alarm_set_callback(latency_alarm, wake_irq);
+    bench_reset(&bench, name, 0);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        network_event_stats_t stats;
+        network_get_event_stats(&stats);
+        const uint32_t wakes = stats.wakes;
+
+        const uint64_t target = latency_arm();
+        do {
+            network_step();
+            if (event) {
+                network_wait();
+            }
+            network_get_event_stats(&stats);
+        } while (stats.wakes == wakes);
+
+        bench_add(&bench, (time_us_64() - target) * bench_clk_mhz);
+    }
+
+    bench_report(&bench);
+    hardware_alarm_set_callback(latency_alarm, latency_irq);
+}
+
+// Uses the last block of the LittleFS partition, its content is lost.
+static void bench_lfs_rp2040() {
+    struct lfs_config cfg = {0};
+    if (!lfs_rp2040_init(&cfg)) {
+        printf("# lfs_rp2040: flash not available\n");
+        return;
+    }
+
+    const lfs_block_t block = cfg.block_count - 1;
+    const uint pages = cfg.block_size / cfg.prog_size;
+
+    bench_reset(&erase, "lfs_rp2040_erase", cfg.block_size);
+    bench_reset(&bench, "lfs_rp2040_prog", cfg.prog_size);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        const uint page = i % pages;
+
+        if (page == 0) {
+            bench_begin(&erase);
+            lfs_rp2040_erase(&cfg, block);
+            bench_end(&erase);
+        }
+
+        // Programs are deferred until sync, the pair is one page program.
+        bench_begin(&bench);
+        lfs_rp2040_prog(&cfg, block, page * cfg.prog_size, data, cfg.prog_size);
+        lfs_rp2040_sync(&cfg);
+        bench_end(&bench);
+    }
+
+    bench_report(&bench);
+    bench_report(&erase);
+
+    // A block written page by page, merged into one flash program.
+    bench_reset(&bench, "lfs_rp2040_prog_merged_4096", cfg.block_size);
+    for (int i = 0; i < ITERATIONS / 16; i++) {
+        lfs_rp2040_erase(&cfg, block);
+
+        bench_begin(&bench);
+        for (uint page = 0; page < pages; page++) {
+            lfs_rp2040_prog(&cfg, block, page * cfg.prog_size, data, cfg.prog_size);
+        }
+        lfs_rp2040_sync(&cfg);
+        bench_end(&bench);
+    }
+    bench_report(&bench);
+
+    bench_reset(&bench, "lfs_rp2040_read_256", 256);
+    for (int i = 0; i < ITERATIONS; i++) {
+        bench_begin(&bench);
+        lfs_rp2040_read(&cfg, block, (i % pages) * 256, frame, 256);
+        bench_end(&bench);
+    }
+    bench_report(&bench);
+
+    // The partition ends where the free region starts.
+    uint32_t free_pos, free_size;
+    lfs_rp2040_get_free_region(&free_pos, &free_size);
+    const uint8_t* block_xip = (const uint8_t*)(XIP_BASE + free_pos - cfg.block_size);
+
+    bench_reset(&bench, "irq_off_read_4096", cfg.block_size);
+    for (int i = 0; i < ITERATIONS; i++) {
+        bench_begin(&bench);
+        read_irq_off(data, block_xip, cfg.block_size);
+        bench_end(&bench);
+    }
+    bench_report(&bench);
+
+    bench_reset(&bench, "lfs_rp2040_read_4096", cfg.block_size);
+    for (int i = 0; i < ITERATIONS; i++) {
+        bench_begin(&bench);
+        lfs_rp2040_read(&cfg, block, 0, data, cfg.block_size);
+        bench_end(&bench);
+    }
+    bench_report(&bench);
+
+    bench_reset(&bench, "irq_latency_irq_off_read_4096", 0);
+    for (int i = 0; i < ITERATIONS; i++) {
+        const uint64_t target = latency_arm();
+        read_irq_off(data, block_xip, cfg.block_size);
+        latency_collect(&bench, target);
+    }
+    bench_report(&bench);
+
+    bench_reset(&bench, "irq_latency_read_4096", 0);
+    for (int i = 0; i < ITERATIONS; i++) {
+        const uint64_t target = latency_arm();
+        lfs_rp2040_read(&cfg, block, 0, data, cfg.block_size);
+        latency_collect(&bench, target);
+    }
+    bench_report(&bench);
+
+    bench_reset(&bench, "irq_latency_prog", 0);
+    for (int i = 0; i < ITERATIONS; i++) {
+        const uint page = i % pages;
+
+        if (page == 0) {
+            lfs_rp2040_erase(&cfg, block);
+        }
+
+        const uint64_t target = latency_arm();
+        lfs_rp2040_prog(&cfg, block, page * cfg.prog_size, data, cfg.prog_size);
+        lfs_rp2040_sync(&cfg);
+        latency_collect(&bench, target);
+    }
+    bench_report(&bench);
+}
+
+#ifdef BENCH_FILESYSTEM
+#define FS_RUNS 8
+#define FS_WRITE_SIZE (64 * 1024)
+
+// Formats the LittleFS partition with each preset, its content is lost.
+static void bench_lfs_preset(const char* name, const lfs_rp2040_params_t* params) {
+    static char label[48];
+    static lfs_t lfs;
+    static lfs_file_t file;
+
+    struct lfs_config cfg = {0};
+    if (!lfs_rp2040_init_with(&cfg, params)) {
+        printf("# %s: invalid params\n", name);
+        return;
+    }
+
+    snprintf(label, sizeof(label), "lfs_%s_format_mount", name);
+    bench_reset(&bench, label, 0);
+    for (int i = 0; i < FS_RUNS; i++) {
+        bench_begin(&bench);
+        lfs_format(&lfs, &cfg);
+        lfs_mount(&lfs, &cfg);
+        bench_end(&bench);
+        lfs_unmount(&lfs);
+    }
+    bench_report(&bench);
+
+    // The first allocation after a mount scans the whole partition
+    // in lookahead sized windows.
+    snprintf(label, sizeof(label), "lfs_%s_first_alloc", name);
+    bench_reset(&bench, label, 0);
+    for (int i = 0; i < FS_RUNS; i++) {
+        lfs_mount(&lfs, &cfg);
+
+        bench_begin(&bench);
+        lfs_file_open(&lfs, &file, "alloc", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+        lfs_file_write(&lfs, &file, data, cfg.block_size);
+        lfs_file_close(&lfs, &file);
+        bench_end(&bench);
+
+        lfs_unmount(&lfs);
+    }
+    bench_report(&bench);
+
+    snprintf(label, sizeof(label), "lfs_%s_write_64k", name);
+    bench_reset(&bench, label, FS_WRITE_SIZE);
+    lfs_mount(&lfs, &cfg);
+    for (int i = 0; i < FS_RUNS; i++) {
+        bench_begin(&bench);
+        lfs_file_open(&lfs, &file, "seq", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+        for (uint n = 0; n < FS_WRITE_SIZE; n += 4096) {
+            lfs_file_write(&lfs, &file, data, 4096);
+        }
+        lfs_file_close(&lfs, &file);
+        bench_end(&bench);
+    }
+    lfs_unmount(&lfs);
+    bench_report(&bench);
+}
+
+static void bench_lfs_filesystem() {
+    bench_lfs_preset("small", &LFS_RP2040_PRESET_SMALL);
+    bench_lfs_preset("default", &LFS_RP2040_PRESET_DEFAULT);
+    bench_lfs_preset("fast", &LFS_RP2040_PRESET_FAST);
+}
+#endif
+
+static void run() {
+    bench_report_header();
+
+    fill_data();
+    check_chksum();
+    bench_chksum("chksum_m0_64", chksum_m0, 0, 64);
+    bench_chksum("chksum_lwip_64", chksum_lwip, 0, 64);
+    bench_chksum("chksum_m0_1460", chksum_m0, 0, 1460);
+    bench_chksum("chksum_lwip_1460", chksum_lwip, 0, 1460);
+    bench_chksum("chksum_m0_1460_odd", chksum_m0, 1, 1460);
+    bench_chksum("chksum_lwip_1460_odd", chksum_lwip, 1, 1460);
+    bench_dma_sniff("chksum_dma_sniff_1460", 1460);
+
+    bench_xmit_cb();
+    bench_wake_latency("wake_latency_poll", false);
+    bench_wake_latency("wake_latency_event", true);
+    bench_bmp_calibrate_pressure();
+    bench_recording_pack();
+    bench_recording_decode();
+    bench_lfs_rp2040();
+#ifdef BENCH_FILESYSTEM
+    bench_lfs_filesystem();
+#endif
+
+    printf("# done\n");
+}
+
+int main(void) {
+    stdio_init_all();
+    bench_init();
+
+    // pbufs only, the USB network interface isn't started.
+    lwip_init();
+
+    latency_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(latency_alarm, latency_irq);
+
+    // Core1 isn't started, the flash needs no lockout.
+    lfs_rp2040_allow_unlocked_flash(true);
+
+    sleep_ms(2000);
+    run();
+
+    // Any character runs the benchmarks again.
+    while (true) {
+        getchar();
+        run();
+    }
+
+    return 0;
+}
@@ -21,7 +21,12 @@ int main(void) {
 
     printf("Hello from Pi Pico!\n");
 
-    lfs_rp2040_init(&cfg);
+    // Core1 isn't started, the flash needs no lockout.
+    lfs_rp2040_allow_unlocked_flash(true);
+    if (!lfs_rp2040_init(&cfg)) {
+        printf("Flash not available.\n");
+        return 1;
+    }
 
     // mount the filesystem
     int err = lfs_mount(&lfs, &cfg);
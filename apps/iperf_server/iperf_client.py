@@ -0,0 +1,78 @@
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "../../lib/usb_network_stack"))
+from rpc_client import RpcClient  # noqa: E402
+
+# Starts the device-side tests of iperf_server and prints the device-side results.
+# Run an iperf2 server on the host first:
+#
+#   iperf -s          # TCP, device -> host
+#   iperf -s -u       # UDP, device -> host
+#
+#   python3 iperf_client.py tcp
+#   python3 iperf_client.py udp --payload 1472 --rate 8000 --duration 10
+#   python3 iperf_client.py result   # also shows the last host -> device test
+#   python3 iperf_client.py stop     # ends a running device -> host test
+
+RPC_METHOD_TCP_CLIENT = 1
+RPC_METHOD_UDP_BLAST = 2
+RPC_METHOD_RESULT = 3
+RPC_METHOD_STOP = 4
+
+TESTS = {0: "none", 1: "tcp rx", 2: "tcp tx", 3: "udp tx"}
+RESULT = struct.Struct("<BBIIIIIIH")
+RESULT_FIELDS = ("test", "running", "packets", "bytes", "drops", "late",
+                 "duration_ms", "kbps", "idle_permille")
+
+
+def get_result(rpc):
+    return dict(zip(RESULT_FIELDS, RESULT.unpack(rpc.call(RPC_METHOD_RESULT))))
+
+
+def print_result(result):
+    idle = result["idle_permille"]
+    print(f"Test: {TESTS.get(result['test'], result['test'])}")
+    print(f"  {result['bytes']} bytes in {result['duration_ms']} ms, {result['kbps']} kbit/s")
+    if result["test"] == 3:
+        print(f"  {result['packets']} packets, {result['drops']} refused, {result['late']} late")
+    print("  CPU idle: " + ("n/a" if idle == 0xFFFF else f"{idle / 10:.1f} %"))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("test", choices=("tcp", "udp", "result", "stop"))
+    parser.add_argument("--device", default="192.168.7.1")
+    parser.add_argument("--host", default="192.168.7.2", help="address of the iperf server")
+    parser.add_argument("--port", type=int, default=5001)
+    parser.add_argument("--payload", type=int, default=1472)
+    parser.add_argument("--rate", type=int, default=0, help="kbit/s, 0 is unlimited")
+    parser.add_argument("--duration", type=int, default=10, help="seconds, UDP only")
+    args = parser.parse_args()
+
+    rpc = RpcClient(args.device)
+    ip = socket.inet_aton(args.host)
+
+    if args.test == "tcp":
+        rpc.call(RPC_METHOD_TCP_CLIENT, ip + struct.pack("<H", args.port))
+    elif args.test == "udp":
+        rpc.call(RPC_METHOD_UDP_BLAST, ip + struct.pack("<HHIH", args.port, args.payload,
+                                                        args.rate, args.duration))
+    elif args.test == "stop":
+        rpc.call(RPC_METHOD_STOP)
+
+    while True:
+        result = get_result(rpc)
+        if not result["running"]:
+            break
+        time.sleep(0.5)
+
+    print_result(result)
+
+
+if __name__ == "__main__":
+    main()
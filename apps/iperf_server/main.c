@@ -26,221 +26,324 @@
  */
 
 /*
-this appears as either a RNDIS or CDC-ECM USB virtual network adapter; the OS picks its preference
-
-RNDIS should be valid on Linux and Windows hosts, and CDC-ECM should be valid on Linux and macOS hosts
-
-The MCU appears to the host as IP address 192.168.7.1, and provides a DHCP server, DNS server, and web server.
+The network interface, DHCP and DNS servers come from the USB Network Stack library.
+On top of it this app runs:
+- the lwIP iperf server (host -> device TCP),
+- a device-side iperf TCP client (device -> host TCP),
+- a UDP blaster with iperf2 datagram headers (device -> host UDP).
+The device-side tests are started and read back over the RPC server.
 */
-/*
-Some smartphones *may* work with this implementation as well, but likely have limited (broken) drivers,
-and likely their manufacturer has not tested such functionality.  Some code workarounds could be tried:
 
-The smartphone may only have an ECM driver, but refuse to automatically pick ECM (unlike the OSes above);
-try modifying ./examples/devices/net_lwip_webserver/usb_descriptors.c so that CONFIG_ID_ECM is default.
+#include <string.h>
 
-The smartphone may be artificially picky about which Ethernet MAC address to recognize; if this happens,
-try changing the first byte of tud_network_mac_address[] below from 0x02 to 0x00 (clearing bit 1).
-*/
+#include "pico/stdlib.h"
+#include "lwip/udp.h"
+#include "lwiperf.h"
+#include "httpd.h"
 
-#include "bsp/board.h"
-#include "tusb.h"
+#include "usb_network.h"
+#include "usb_network_rpc.h"
+
+#define RPC_METHOD_TCP_CLIENT 1
+#define RPC_METHOD_UDP_BLAST  2
+#define RPC_METHOD_RESULT     3
+#define RPC_METHOD_STOP       4
+
+#define UDP_MAX_PAYLOAD 1472    // Largest payload without IP fragmentation.
+#define UDP_MIN_PAYLOAD 16      // iperf2 datagram header.
+#define UDP_MAX_BURST 8         // Packets sent back-to-back when behind schedule.
+
+#define IDLE_UNKNOWN 0xFFFF     // The iperf server doesn't report when a test starts.
+
+typedef enum {
+    TEST_NONE,
+    TEST_TCP_RX,    // Host iperf client -> lwiperf server.
+    TEST_TCP_TX,    // lwiperf client -> host iperf server.
+    TEST_UDP_TX,    // UDP blaster -> host iperf server (-u).
+} test_type_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t ip[4];
+    uint16_t port;
+} tcp_client_args_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t ip[4];
+    uint16_t port;
+    uint16_t payload;           // Bytes per datagram, UDP_MIN_PAYLOAD to UDP_MAX_PAYLOAD.
+    uint32_t rate_kbps;         // 0 sends as fast as possible.
+    uint16_t duration_s;
+} udp_blast_args_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t test;               // test_type_t of the last test.
+    uint8_t running;
+    uint32_t packets;           // Datagrams sent, UDP only.
+    uint32_t bytes;             // Payload bytes.
+    uint32_t drops;             // Datagrams refused by the stack, UDP only.
+    uint32_t late;              // Datagrams skipped to get back on schedule, UDP only.
+    uint32_t duration_ms;
+    uint32_t kbps;
+    uint16_t idle_permille;     // Time spent asleep in network_wait().
+} test_result_t;
+
+// iperf2 UDP datagram header, big-endian.
+typedef struct __attribute__((packed)) {
+    int32_t id;                 // Negative on the last datagram.
+    uint32_t tv_sec;
+    uint32_t tv_usec;
+    uint32_t reserved;
+} iperf_udp_header_t;
+
+static struct {
+    struct udp_pcb* pcb;
+    ip_addr_t addr;
+    uint16_t port;
+    uint16_t payload;
+    uint32_t interval_us;
+    uint64_t next_us;
+    uint64_t end_us;
+    int32_t id;
+    bool alarm_pending;
+} blast;
+
+static uint8_t udp_payload[UDP_MAX_PAYLOAD];
+
+static test_result_t result;
+static void* tcp_client;        // lwiperf session of a running TEST_TCP_TX.
+static uint64_t test_start_us;
+static uint64_t test_start_sleep_us;
+
+static void test_begin(test_type_t type) {
+    network_event_stats_t stats;
+    network_get_event_stats(&stats);
+
+    result = (test_result_t){
+        .test = type,
+        .running = true,
+    };
+
+    test_start_us = time_us_64();
+    test_start_sleep_us = stats.sleep_us;
+}
 
-#include "dhserver.h"
-#include "dnserver.h"
-#include "lwip/init.h"
-#include "lwip/timeouts.h"
+static void test_end(uint32_t bytes, uint32_t duration_ms) {
+    network_event_stats_t stats;
+    network_get_event_stats(&stats);
 
-#include "lwiperf.h"
-#include "httpd.h"
+    const uint64_t elapsed_us = time_us_64() - test_start_us;
 
-/* lwip context */
-static struct netif netif_data;
-
-/* shared between tud_network_recv_cb() and service_traffic() */
-static struct pbuf *received_frame;
-
-/* this is used by this code, ./class/net/net_driver.c, and usb_descriptors.c */
-/* ideally speaking, this should be generated from the hardware's unique ID (if available) */
-/* it is suggested that the first byte is 0x02 to indicate a link-local address */
-const uint8_t tud_network_mac_address[6] = {0x02,0x02,0x84,0x6A,0x96,0x00};
-
-/* network parameters of this MCU */
-static const ip_addr_t ipaddr  = IPADDR4_INIT_BYTES(192, 168, 7, 1);
-static const ip_addr_t netmask = IPADDR4_INIT_BYTES(255, 255, 255, 0);
-static const ip_addr_t gateway = IPADDR4_INIT_BYTES(0, 0, 0, 0);
-
-/* database IP addresses that can be offered to the host; this must be in RAM to store assigned MAC addresses */
-static dhcp_entry_t entries[] =
-{
-    /* mac ip address                          lease time */
-    { {0}, IPADDR4_INIT_BYTES(192, 168, 7, 2), 24 * 60 * 60 },
-    { {0}, IPADDR4_INIT_BYTES(192, 168, 7, 3), 24 * 60 * 60 },
-    { {0}, IPADDR4_INIT_BYTES(192, 168, 7, 4), 24 * 60 * 60 },
-};
-
-static const dhcp_config_t dhcp_config =
-{
-    .router = IPADDR4_INIT_BYTES(0, 0, 0, 0),  /* router address (if any) */
-    .port = 67,                                /* listen port */
-    .dns = IPADDR4_INIT_BYTES(192, 168, 7, 1), /* dns server (if any) */
-    "usb",                                     /* dns suffix */
-    TU_ARRAY_SIZE(entries),                    /* num entry */
-    entries                                    /* entries */
-};
-static err_t linkoutput_fn(struct netif *netif, struct pbuf *p)
-{
-  (void)netif;
-
-  for (;;)
-  {
-    /* if TinyUSB isn't ready, we must signal back to lwip that there is nothing we can do */
-    if (!tud_ready())
-      return ERR_USE;
-
-    /* if the network driver can accept another packet, we make it happen */
-    if (tud_network_can_xmit(p->tot_len))
-    {
-      tud_network_xmit(p, 0 /* unused for this example */);
-      return ERR_OK;
+    result.running = false;
+    result.bytes = bytes;
+    result.duration_ms = duration_ms;
+    result.kbps = duration_ms ? (uint64_t)bytes * 8 / duration_ms : 0;
+    result.idle_permille = elapsed_us ? (stats.sleep_us - test_start_sleep_us) * 1000 / elapsed_us : 0;
+}
+
+static void iperf_report(void *arg, enum lwiperf_report_type report_type,
+                         const ip_addr_t* local_addr, u16_t local_port,
+                         const ip_addr_t* remote_addr, u16_t remote_port,
+                         u32_t bytes_transferred, u32_t ms_duration, u32_t bandwidth_kbitpsec) {
+    if ((test_type_t)(uintptr_t)arg == TEST_TCP_RX) {
+        // A device-side test owns the result until it ends.
+        if (result.running) {
+            return;
+        }
+
+        result = (test_result_t){
+            .test = TEST_TCP_RX,
+            .bytes = bytes_transferred,
+            .duration_ms = ms_duration,
+            .kbps = bandwidth_kbitpsec,
+            .idle_permille = IDLE_UNKNOWN,
+        };
+        return;
     }
 
-    /* transfer execution to TinyUSB in the hopes that it will finish transmitting the prior packet */
-    tud_task();
-  }
+    // lwiperf frees the session after its report.
+    tcp_client = NULL;
+    test_end(bytes_transferred, ms_duration);
 }
 
-static err_t output_fn(struct netif *netif, struct pbuf *p, const ip_addr_t *addr)
-{
-  return etharp_output(netif, p, addr);
+static int64_t blast_alarm(alarm_id_t id, void *user_data) {
+    blast.alarm_pending = false;
+    network_wake();
+    return 0;
 }
 
-static err_t netif_init_cb(struct netif *netif)
-{
-  LWIP_ASSERT("netif != NULL", (netif != NULL));
-  netif->mtu = CFG_TUD_NET_MTU;
-  netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
-  netif->state = NULL;
-  netif->name[0] = 'E';
-  netif->name[1] = 'X';
-  netif->linkoutput = linkoutput_fn;
-  netif->output = output_fn;
-  return ERR_OK;
+static void blast_finish() {
+    udp_remove(blast.pcb);
+    blast.pcb = NULL;
+
+    test_end(result.bytes, (time_us_64() - test_start_us) / 1000);
 }
 
-static void init_lwip(void)
-{
-  struct netif *netif = &netif_data;
+static bool blast_send(int32_t id) {
+    const uint64_t now = time_us_64();
+    iperf_udp_header_t* header = (iperf_udp_header_t*)udp_payload;
 
-  lwip_init();
+    header->id = lwip_htonl(id);
+    header->tv_sec = lwip_htonl(now / 1000000);
+    header->tv_usec = lwip_htonl(now % 1000000);
 
-  /* the lwip virtual MAC address must be different from the host's; to ensure this, we toggle the LSbit */
-  netif->hwaddr_len = sizeof(tud_network_mac_address);
-  memcpy(netif->hwaddr, tud_network_mac_address, sizeof(tud_network_mac_address));
-  netif->hwaddr[5] ^= 0x01;
+    // The payload is copied into the USB buffer before udp_send() returns,
+    // so a reference to the static buffer is enough.
+    struct pbuf* p = pbuf_alloc(PBUF_RAW, blast.payload, PBUF_REF);
+    if (p == NULL) {
+        return false;
+    }
+    p->payload = udp_payload;
 
-  netif = netif_add(netif, &ipaddr, &netmask, &gateway, NULL, netif_init_cb, ip_input);
-  netif_set_default(netif);
-}
+    const err_t err = udp_sendto(blast.pcb, p, &blast.addr, blast.port);
+    pbuf_free(p);
 
-/* handle any DNS requests from dns-server */
-bool dns_query_proc(const char *name, ip_addr_t *addr)
-{
-  if (0 == strcmp(name, "tiny.usb"))
-  {
-    *addr = ipaddr;
-    return true;
-  }
-  return false;
+    return err == ERR_OK;
 }
 
-bool tud_network_recv_cb(const uint8_t *src, uint16_t size)
-{
-  /* this shouldn't happen, but if we get another packet before
-  parsing the previous, we must signal our inability to accept it */
-  if (received_frame) return false;
+// Sends every datagram that is due and arms an alarm for the next one.
+static void blast_step() {
+    if (blast.pcb == NULL) {
+        return;
+    }
+
+    uint64_t now = time_us_64();
 
-  if (size)
-  {
-    struct pbuf *p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
+    if (now >= blast.end_us) {
+        // The last datagram is repeated, the host may lose one. Its negative
+        // id ends the test, -0 would be read as a datagram, so at least -1.
+        for (int i = 0; i < 3; i++) {
+            blast_send(-MAX(blast.id, 1));
+        }
+        blast_finish();
+        return;
+    }
 
-    if (p)
-    {
-      /* pbuf_alloc() has already initialized struct; all we need to do is copy the data */
-      memcpy(p->payload, src, size);
+    // Too far behind: skip ahead instead of bursting forever.
+    if (blast.interval_us && now > blast.next_us + UDP_MAX_BURST * blast.interval_us) {
+        const uint64_t behind = (now - blast.next_us) / blast.interval_us;
+        result.late += behind;
+        blast.next_us += behind * blast.interval_us;
+    }
 
-      /* store away the pointer for service_traffic() to later handle */
-      received_frame = p;
+    for (int i = 0; i < UDP_MAX_BURST && now >= blast.next_us; i++) {
+        if (blast_send(blast.id)) {
+            result.packets += 1;
+            result.bytes += blast.payload;
+        } else {
+            result.drops += 1;
+        }
+
+        blast.id += 1;
+        blast.next_us += blast.interval_us;
+        now = time_us_64();
     }
-  }
 
-  return true;
+    if (blast.interval_us == 0) {
+        network_wake();
+    } else if (!blast.alarm_pending && blast.next_us > now) {
+        blast.alarm_pending = true;
+        if (add_alarm_at(from_us_since_boot(blast.next_us), blast_alarm, NULL, true) < 0) {
+            blast.alarm_pending = false;
+            network_wake();
+        }
+    }
 }
 
-uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg)
-{
-  struct pbuf *p = (struct pbuf *)ref;
-  struct pbuf *q;
-  uint16_t len = 0;
+static uint8_t rpc_tcp_client(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    if (len != sizeof(tcp_client_args_t) || result.running) {
+        return NETWORK_RPC_ERR_ARGS;
+    }
 
-  (void)arg; /* unused for this example */
+    const tcp_client_args_t* req = (const tcp_client_args_t*)args;
 
-  /* traverse the "pbuf chain"; see ./lwip/src/core/pbuf.c for more info */
-  for(q = p; q != NULL; q = q->next)
-  {
-    memcpy(dst, (char *)q->payload, q->len);
-    dst += q->len;
-    len += q->len;
-    if (q->len == q->tot_len) break;
-  }
+    ip_addr_t addr;
+    IP4_ADDR(&addr, req->ip[0], req->ip[1], req->ip[2], req->ip[3]);
 
-  return len;
+    test_begin(TEST_TCP_TX);
+    tcp_client = lwiperf_start_tcp_client(&addr, req->port, LWIPERF_CLIENT, iperf_report, (void*)TEST_TCP_TX);
+    if (tcp_client == NULL) {
+        result.running = false;
+        return NETWORK_RPC_ERR_ARGS;
+    }
+
+    return NETWORK_RPC_OK;
 }
 
-static void service_traffic(void)
-{
-  /* handle any packet received by tud_network_recv_cb() */
-  if (received_frame)
-  {
-    ethernet_input(received_frame, &netif_data);
-    pbuf_free(received_frame);
-    received_frame = NULL;
-    tud_network_recv_renew();
-  }
-
-  sys_check_timeouts();
+static uint8_t rpc_udp_blast(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    if (len != sizeof(udp_blast_args_t) || result.running) {
+        return NETWORK_RPC_ERR_ARGS;
+    }
+
+    const udp_blast_args_t* req = (const udp_blast_args_t*)args;
+
+    if (req->payload < UDP_MIN_PAYLOAD || req->payload > UDP_MAX_PAYLOAD || req->duration_s == 0) {
+        return NETWORK_RPC_ERR_ARGS;
+    }
+
+    blast.pcb = udp_new();
+    if (blast.pcb == NULL) {
+        return NETWORK_RPC_ERR_ARGS;
+    }
+
+    IP4_ADDR(&blast.addr, req->ip[0], req->ip[1], req->ip[2], req->ip[3]);
+    blast.port = req->port;
+    blast.payload = req->payload;
+    blast.interval_us = req->rate_kbps ? (uint64_t)req->payload * 8000 / req->rate_kbps : 0;
+    blast.id = 0;
+
+    test_begin(TEST_UDP_TX);
+    blast.next_us = test_start_us;
+    blast.end_us = test_start_us + (uint64_t)req->duration_s * 1000000;
+
+    network_wake();
+
+    return NETWORK_RPC_OK;
 }
 
-void tud_network_init_cb(void)
-{
-  /* if the network is re-initializing and we have a leftover packet, we must do a cleanup */
-  if (received_frame)
-  {
-    pbuf_free(received_frame);
-    received_frame = NULL;
-  }
+static uint8_t rpc_result(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    reply->data = &result;
+    reply->len = sizeof(result);
+    reply->copy = true;
+    return NETWORK_RPC_OK;
 }
 
-int main(void)
-{
-  /* initialize TinyUSB */
-  board_init();
-  tusb_init();
+static uint8_t rpc_stop(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    if (blast.pcb) {
+        blast.end_us = 0;
+        network_wake();
+    }
 
-  /* initialize lwip, dhcp-server, dns-server, and http */
-  init_lwip();
-  while (!netif_is_up(&netif_data));
-  while (dhserv_init(&dhcp_config) != ERR_OK);
-  while (dnserv_init(&ipaddr, 53, dns_query_proc) != ERR_OK);
-  httpd_init();
+    // An aborted session doesn't report, the byte count is lost.
+    if (tcp_client) {
+        lwiperf_abort(tcp_client);
+        tcp_client = NULL;
+        test_end(0, (time_us_64() - test_start_us) / 1000);
+    }
 
-  lwiperf_start_tcp_server_default(NULL, NULL);
+    return NETWORK_RPC_OK;
+}
 
-  while (1)
-  {
-    tud_task();
-    service_traffic();
-  }
+int main(void) {
+    // Init network stack and the sample HTTP page.
+    network_init();
+    httpd_init();
+
+    // Host -> device TCP.
+    lwiperf_start_tcp_server_default(iperf_report, (void*)TEST_TCP_RX);
+
+    // Device -> host tests.
+    network_rpc_init();
+    network_rpc_register(RPC_METHOD_TCP_CLIENT, rpc_tcp_client, NULL);
+    network_rpc_register(RPC_METHOD_UDP_BLAST, rpc_udp_blast, NULL);
+    network_rpc_register(RPC_METHOD_RESULT, rpc_result, NULL);
+    network_rpc_register(RPC_METHOD_STOP, rpc_stop, NULL);
+
+    // Listen to events.
+    while (1) {
+        network_step();
+        blast_step();
+        network_wait();
+    }
 
-  return 0;
+    return 0;
 }
@@ -3,43 +3,52 @@
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
 #include "lwip/tcp.h"
-#include "hardware/dma.h"
-#include "hardware/irq.h"
 #include "usb_network.h"
+#include "dma_stream_udp.h"
+#include "usb_network_rpc.h"
 
-uint data_ovf;
-uint data_dma;
-bool data_val;
 bool streaming;
 struct repeating_timer timer;
 
 #define CAPTURE_CHANNEL 0
 #define CAPTURE_DEPTH 1472
-
-uint dma_chan_a, dma_chan_b;
-struct pbuf *pbuf_a, *pbuf_b;
-
-static void dma_handler(uint id) {
-    if (data_val) {
-        data_ovf += 1;
-    }
-    data_dma = id;
-    data_val = true;
-}
-
-static void dma_handler_a() {
-    dma_handler(0);
-    dma_channel_set_write_addr(dma_chan_a, pbuf_a->payload, false);
-    dma_hw->ints0 = 1u << dma_chan_a;
-}
-
-static void dma_handler_b() {
-    dma_handler(1);
-    dma_channel_set_write_addr(dma_chan_b, pbuf_b->payload, false);
-    dma_hw->ints1 = 1u << dma_chan_b;
-}
-
-static void init_adc_dma_chain() {
+#define CAPTURE_BUFFERS 2
+
+#define RPC_METHOD_START 1
+#define RPC_METHOD_STOP  2
+#define RPC_METHOD_STATS 3
+#define RPC_METHOD_INFO  4
+
+dma_stream_t stream;
+dma_stream_udp_t stream_udp;
+
+typedef struct __attribute__((packed)) {
+    uint32_t sample_rate;
+    uint16_t sample_bits;
+    uint16_t block_size;
+    uint16_t udp_port;
+} piccolo_info_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t streaming;
+    uint32_t blocks;
+    uint32_t bytes;
+    uint32_t overruns;
+    uint32_t max_pending;
+    uint32_t service_max_us;
+    uint32_t udp_sent;
+    uint32_t udp_errors;
+    uint32_t wake_latency_max_us;
+} piccolo_stats_t;
+
+static const piccolo_info_t info = {
+    .sample_rate = 500000,
+    .sample_bits = 8,
+    .block_size = CAPTURE_DEPTH,
+    .udp_port = 7778,
+};
+
+static void init_adc() {
     adc_gpio_init(26 + CAPTURE_CHANNEL);
     adc_init();
     adc_select_input(CAPTURE_CHANNEL);
@@ -51,54 +60,6 @@ static void init_adc_dma_chain() {
         true    // Shift each sample by 8 bits
     );
     adc_set_clkdiv(0);
-
-    dma_channel_config dma_cfg_a, dma_cfg_b;
-
-    dma_chan_a = dma_claim_unused_channel(true);
-    dma_chan_b = dma_claim_unused_channel(true);
-
-    dma_cfg_a = dma_channel_get_default_config(dma_chan_a);
-    dma_cfg_b = dma_channel_get_default_config(dma_chan_b);
-
-    channel_config_set_transfer_data_size(&dma_cfg_a, DMA_SIZE_8);
-    channel_config_set_transfer_data_size(&dma_cfg_b, DMA_SIZE_8);
-
-    channel_config_set_read_increment(&dma_cfg_a, false);
-    channel_config_set_read_increment(&dma_cfg_b, false);
-
-    channel_config_set_write_increment(&dma_cfg_a, true);
-    channel_config_set_write_increment(&dma_cfg_b, true);
-
-    channel_config_set_dreq(&dma_cfg_a, DREQ_ADC);
-    channel_config_set_dreq(&dma_cfg_b, DREQ_ADC);
-
-    channel_config_set_chain_to(&dma_cfg_a, dma_chan_b);
-    channel_config_set_chain_to(&dma_cfg_b, dma_chan_a);
-
-    dma_channel_configure(dma_chan_a, &dma_cfg_a,
-        pbuf_a->payload,// dst
-        &adc_hw->fifo,  // src
-        CAPTURE_DEPTH,  // transfer count
-        true            // start now
-    );
-
-    dma_channel_configure(dma_chan_b, &dma_cfg_b,
-        pbuf_b->payload, // dst
-        &adc_hw->fifo,  // src
-        CAPTURE_DEPTH,  // transfer count
-        false           // start now
-    );
-
-    dma_channel_set_irq0_enabled(dma_chan_a, true);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_handler_a);
-    irq_set_priority(DMA_IRQ_0, 0xFF);
-    irq_set_enabled(DMA_IRQ_0, true);
-
-    dma_channel_set_irq1_enabled(dma_chan_b, true);
-    irq_set_exclusive_handler(DMA_IRQ_1, dma_handler_b);
-    irq_set_priority(DMA_IRQ_1, 0xFF);
-    irq_set_enabled(DMA_IRQ_1, true);
-
     adc_run(false);
 }
 
@@ -107,14 +68,9 @@ static void start_stream(struct tcp_pcb *pcb) {
         return;
     }
 
-    data_ovf = 0;
-    data_dma = 0;
-    data_val = false;
-    streaming = true;
-
-    dma_channel_set_write_addr(dma_chan_a, pbuf_a->payload, true);
-    dma_channel_set_write_addr(dma_chan_b, pbuf_b->payload, false);
+    dma_stream_start(&stream);
     adc_run(true);
+    streaming = true;
 }
 
 static void stop_stream(struct tcp_pcb *pcb) {
@@ -124,15 +80,53 @@ static void stop_stream(struct tcp_pcb *pcb) {
 
     adc_run(false);
     adc_fifo_drain();
-    dma_channel_set_write_addr(dma_chan_a, pbuf_a->payload, false);
-    dma_channel_set_write_addr(dma_chan_b, pbuf_b->payload, false);
-
-    data_ovf = 0;
-    data_dma = 0;
-    data_val = false;
+    dma_stream_stop(&stream);
     streaming = false;
 }
 
+static uint8_t rpc_start(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    start_stream(NULL);
+    return NETWORK_RPC_OK;
+}
+
+static uint8_t rpc_stop(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    stop_stream(NULL);
+    return NETWORK_RPC_OK;
+}
+
+static uint8_t rpc_stats(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    static piccolo_stats_t stats;
+
+    dma_stream_stats_t stream_stats;
+    dma_stream_get_stats(&stream, &stream_stats);
+
+    network_event_stats_t event_stats;
+    network_get_event_stats(&event_stats);
+
+    stats.streaming = streaming;
+    stats.blocks = stream_stats.blocks;
+    stats.bytes = stream_stats.bytes;
+    stats.overruns = stream_stats.overruns;
+    stats.max_pending = stream_stats.max_pending;
+    stats.service_max_us = stream_stats.service_max_us;
+    stats.udp_sent = stream_udp.sent;
+    stats.udp_errors = stream_udp.errors;
+    stats.wake_latency_max_us = event_stats.wake_latency_max_us;
+
+    // A snapshot changes on every call, it must be copied.
+    reply->data = &stats;
+    reply->len = sizeof(stats);
+    reply->copy = true;
+
+    return NETWORK_RPC_OK;
+}
+
+static uint8_t rpc_info(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    reply->data = &info;
+    reply->len = sizeof(info);
+    return NETWORK_RPC_OK;
+}
+
 static bool led_timer(struct repeating_timer *t) {
     int status = 1;
     if (streaming) {
@@ -150,22 +144,41 @@ int main(void) {
     // Init network stack.
     network_init();
 
-    // Allocate zero-copy memory for DMA and UDP.
-    pbuf_a = pbuf_alloc(PBUF_RAW, CAPTURE_DEPTH, PBUF_RAM);
-    pbuf_b = pbuf_alloc(PBUF_RAW, CAPTURE_DEPTH, PBUF_RAM);
+    // Init ADC.
+    init_adc();
+
+    // Init ADC DMA stream. Each block is captured into the payload
+    // of a pbuf and sent with a checksum computed by the DMA sniffer.
+    dma_stream_config_t cfg = {
+        .dreq = DREQ_ADC,
+        .src = &adc_hw->fifo,
+        .element_size = DMA_SIZE_8,
+        .block_size = CAPTURE_DEPTH,
+        .buffer_count = CAPTURE_BUFFERS,
+        .checksum = DMA_STREAM_CHECKSUM_SUM16,
+        .irq = DMA_IRQ_0,
+        .notify = network_wake,
+    };
 
-    if (pbuf_a == NULL && pbuf_b == NULL) {
+    ip_addr_t client;
+    IP4_ADDR(&client, 192, 168, 7, 2);
+
+    if (!dma_stream_udp_init(&stream_udp, &cfg, &client, 7778)) {
         return 1;
     }
 
-    // Init ADC DMA chain.
-    init_adc_dma_chain();
+    if (!dma_stream_init(&stream, &cfg)) {
+        return 1;
+    }
 
-    // Start data UDP port.
-    ip_addr_t client;
-    struct udp_pcb* dpcb = udp_new();
-    IP4_ADDR(&client, 192, 168, 7, 2);
-    udp_connect(dpcb, &client, 7778);
+    dma_stream_add_callback(&stream, dma_stream_udp_send, &stream_udp);
+
+    // Start control server.
+    network_rpc_init();
+    network_rpc_register(RPC_METHOD_START, rpc_start, NULL);
+    network_rpc_register(RPC_METHOD_STOP, rpc_stop, NULL);
+    network_rpc_register(RPC_METHOD_STATS, rpc_stats, NULL);
+    network_rpc_register(RPC_METHOD_INFO, rpc_info, NULL);
 
     // Start LED indicator.
     add_repeating_timer_ms(250, led_timer, NULL, &timer);
@@ -175,18 +188,11 @@ int main(void) {
 
     // Listen to events.
     while (1) {
-        if (data_val && streaming) {
-            if (data_dma == 0) {
-                udp_send(dpcb, pbuf_a);
-            }
-            if (data_dma == 1) {
-                udp_send(dpcb, pbuf_b);
-            }
-
-            data_val = false;
-        }
-
+        dma_stream_service(&stream);
         network_step();
+#ifndef PICCOLOSDR_POLLING
+        network_wait();
+#endif
     }
 
     return 0;
@@ -0,0 +1,81 @@
+import os
+import socket
+import statistics
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(__file__))
+from stream_client import BLOCK_HEADER, BLOCK_MAGIC, STATS, STATS_FIELDS, RPC_METHOD_STATS, recv_exact, sync  # noqa: E402
+from rpc_client import RpcClient  # noqa: E402
+
+# Compares the latency and throughput profiles of tcp_server on the binary stream.
+#
+#   python3 bench_modes.py [host] [seconds]
+#
+# Blocks are captured at a fixed rate, so block i should arrive at t0 + i * period.
+# The delay of each block is its arrival minus that schedule, relative to the
+# fastest block of the run: it is the time added by batching and the network.
+
+PROFILES = {"latency": b"L", "throughput": b"H"}
+
+
+def run(host, profile, seconds, period):
+    sock = socket.create_connection((host, 7777))
+    sock.sendall(b"B" + PROFILES[profile])
+
+    header = sync(sock)
+    start = time.perf_counter()
+    received = 0
+    arrivals = []
+
+    while time.perf_counter() - start < seconds:
+        magic, samples, index = BLOCK_HEADER.unpack(header)
+        if magic != BLOCK_MAGIC:
+            raise RuntimeError("out of sync")
+
+        recv_exact(sock, samples * 2)
+        arrivals.append((index, time.perf_counter()))
+        received += BLOCK_HEADER.size + samples * 2
+
+        header = recv_exact(sock, BLOCK_HEADER.size)
+
+    elapsed = time.perf_counter() - start
+    sock.sendall(b"X")
+    sock.close()
+
+    first_index, first_time = arrivals[0]
+    offsets = [(t - first_time) - (i - first_index) * period for i, t in arrivals]
+    base = min(offsets)
+    delays = sorted((o - base) * 1000 for o in offsets)
+
+    return {
+        "kB/s": received / elapsed / 1000,
+        "blocks": len(arrivals),
+        "missing": arrivals[-1][0] - first_index + 1 - len(arrivals),
+        "median ms": statistics.median(delays),
+        "p99 ms": delays[int(len(delays) * 0.99)],
+        "max ms": delays[-1],
+    }
+
+
+def main(host="192.168.7.1", seconds="10"):
+    rpc = RpcClient(host)
+    stats = dict(zip(STATS_FIELDS, STATS.unpack(rpc.call(RPC_METHOD_STATS))))
+
+    sock = socket.create_connection((host, 7777))
+    sock.sendall(b"B")
+    _, samples, _ = BLOCK_HEADER.unpack(sync(sock))
+    sock.sendall(b"X")
+    sock.close()
+
+    period = samples / stats["sample_rate"]
+    print(f"Block period: {period * 1000:.2f} ms")
+
+    for profile in PROFILES:
+        result = run(host, profile, float(seconds), period)
+        print(f"{profile:>10}: " + ", ".join(f"{k}={v:.2f}" if isinstance(v, float) else f"{k}={v}"
+                                             for k, v in result.items()))
+
+
+if __name__ == "__main__":
+    main(*sys.argv[1:])
@@ -1,76 +1,597 @@
 #include <stdio.h>
+#include <string.h>
 #include "bsp/board.h"
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
 #include "usb_network.h"
+#include "usb_network_rpc.h"
+#include "dma_stream.h"
 #include "lwip/tcp.h"
 
-struct tcp_pcb* client;
-struct repeating_timer timer;
+#define SAMPLE_RATE 50000       // Samples per second, up to 500000.
+#define BLOCK_SAMPLES 2048      // One text line per block, about 41 ms.
+#define BLOCK_BUFFERS 4
 
-bool send_timer(struct repeating_timer *t) {
-    const float conversion_factor = 3.3f / (1 << 12);
-    float ADC_voltage = adc_read() * conversion_factor;
+#define MAX_CLIENTS 4
+#define SAMPLE_LINE_MAX 24      // Longest formatted line, "TEMP: -273.150 °C\n".
+#define TEXT_RING_SIZE 8192     // Power of two, larger than TCP_SND_BUF + TCP_MSS.
+#define BINARY_RING_SIZE 65536  // Power of two, room for a few clients several blocks apart.
+#define SEND_FLUSH_MS 500       // Longest time data waits to be coalesced in throughput mode.
+#define DECIMATE_BACKLOG 2      // Unsent blocks before a binary client skips to the newest.
 
-    char str[64];
-    int len = sprintf(str, "TEMP: %f °C\n", 27 - (ADC_voltage - 0.706) / 0.001721);
-    tcp_write(client, str, len, 0);
-    tcp_output(client);
+#define BLOCK_MAGIC 0x4B42      // "BK"
+#define BLOCK_RECORD_SIZE (sizeof(stream_block_header_t) + BLOCK_SAMPLES * 2)
 
-    return true;
+#define RPC_METHOD_STATS 1
+#define RPC_METHOD_CLIENTS 2
+
+typedef enum {
+    STREAM_TEXT,
+    STREAM_BINARY,
+} stream_mode_t;
+
+typedef enum {
+    PROFILE_THROUGHPUT,     // Nagle on, full segments or a flush deadline.
+    PROFILE_LATENCY,        // Nagle off, every record is written as soon as it's encoded.
+} send_profile_t;
+
+// Encoded bytes shared by every client in the same mode, each record is
+// encoded once. Data is sent without a copy, so everything from the oldest
+// unacknowledged byte of any client to the head is pinned.
+typedef struct {
+    uint8_t* data;
+    uint32_t size;
+    uint32_t record_size;   // Fixed record size, 0 if records can't be skipped.
+    uint32_t head;
+} stream_ring_t;
+
+typedef struct {
+    struct tcp_pcb* pcb;
+    stream_mode_t mode;
+    stream_mode_t next_mode;    // Applied once everything in flight is acknowledged.
+    uint32_t sent;              // Ring offset handed to tcp_write().
+    uint32_t acked;             // Ring offset acknowledged by the host.
+    uint32_t record_pos;        // Offset of sent inside its record.
+    bool skip_pending;          // Acknowledgements jump from skip_from to skip_to.
+    uint32_t skip_from;
+    uint32_t skip_to;
+    send_profile_t profile;
+    uint32_t flush_bytes;       // Unsent bytes that trigger a write.
+    uint32_t flush_ms;          // Longest wait for flush_bytes.
+    bool flush_armed;
+    uint32_t flush_deadline;
+    uint8_t cmd;                // Command with arguments being parsed, 0 if none.
+    uint8_t cmd_arg;
+    uint32_t cmd_args[2];
+    uint32_t connected_ms;
+    uint32_t bytes_acked;
+    uint32_t skipped;           // Records skipped to catch up.
+    uint32_t stalls;
+    bool stalled;
+    uint32_t stall_start_us;
+} client_t;
+
+// Prepended to each block in binary mode, samples are little-endian uint16.
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint16_t samples;
+    uint32_t index;
+} stream_block_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t sample_rate;
+    uint8_t clients;
+    uint32_t blocks;            // Captured by DMA.
+    uint32_t overruns;          // Overwritten before the main loop got to them.
+    uint32_t dropped_clients;   // Closed for holding the shared ring.
+    uint32_t skipped;           // Records skipped by slow clients.
+    uint32_t bytes_acked;       // All connections.
+    uint32_t stalls;            // Sends stopped on a full send buffer.
+    uint32_t stall_ms;          // Total time spent with a full send buffer.
+} server_stats_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t mode;
+    uint8_t profile;
+    uint32_t bytes_acked;
+    uint32_t throughput;        // Bytes per second since the connection opened.
+    uint32_t skipped;
+    uint32_t stalls;
+    uint32_t flush_bytes;
+    uint32_t flush_ms;
+} client_stats_t;
+
+uint8_t capture_buf[BLOCK_BUFFERS][BLOCK_SAMPLES * 2];
+uint8_t text_data[TEXT_RING_SIZE];
+uint8_t binary_data[BINARY_RING_SIZE];
+
+stream_ring_t text_ring = { text_data, TEXT_RING_SIZE, 0 };
+stream_ring_t binary_ring = { binary_data, BINARY_RING_SIZE, BLOCK_RECORD_SIZE };
+
+dma_stream_t stream;
+client_t clients[MAX_CLIENTS];
+
+uint32_t dropped_clients;
+uint32_t skipped;
+uint32_t bytes_acked;
+uint32_t stalls;
+uint64_t stall_us;
+
+static int32_t sample_to_millidegrees(uint32_t sum, uint32_t count) {
+    // V = raw * 3.3 / 4096 and T = 27 - (V - 0.706) / 0.001721, in integers.
+    const int32_t microvolts = (int32_t)(((uint64_t)sum * 825000u >> 10) / count);
+    return 27000 - (int32_t)(((int64_t)(microvolts - 706000) * 1000) / 1721);
+}
+
+static char* format_uint(char* out, uint32_t value) {
+    char digits[10];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    while (n) {
+        *out++ = digits[--n];
+    }
+
+    return out;
+}
+
+static int format_sample(char* out, int32_t mdeg) {
+    static const char prefix[] = "TEMP: ";
+    static const char suffix[] = " °C\n";
+
+    char* p = out;
+
+    memcpy(p, prefix, sizeof(prefix) - 1);
+    p += sizeof(prefix) - 1;
+
+    if (mdeg < 0) {
+        *p++ = '-';
+        mdeg = -mdeg;
+    }
+
+    p = format_uint(p, mdeg / 1000);
+    *p++ = '.';
+    *p++ = '0' + (mdeg / 100) % 10;
+    *p++ = '0' + (mdeg / 10) % 10;
+    *p++ = '0' + mdeg % 10;
+
+    memcpy(p, suffix, sizeof(suffix) - 1);
+    p += sizeof(suffix) - 1;
+
+    return p - out;
+}
+
+static stream_ring_t* ring_for(stream_mode_t mode) {
+    return (mode == STREAM_BINARY) ? &binary_ring : &text_ring;
 }
 
-static void srv_close(struct tcp_pcb *pcb){
-    // Cancel send timer.
-    cancel_repeating_timer(&timer);
+static void ring_write(stream_ring_t* ring, const void* src, uint32_t len) {
+    const uint32_t offset = ring->head & (ring->size - 1);
+    const uint32_t first = MIN(len, ring->size - offset);
 
-    tcp_arg(pcb, NULL);
-    tcp_sent(pcb, NULL);
-    tcp_recv(pcb, NULL);
-    tcp_close(pcb);
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, (const uint8_t*)src + first, len - first);
+    ring->head += len;
+}
+
+static void stall_begin(client_t* c) {
+    if (!c->stalled) {
+        c->stalled = true;
+        c->stall_start_us = time_us_32();
+        c->stalls += 1;
+        stalls += 1;
+    }
+}
+
+static void stall_end(client_t* c) {
+    if (c->stalled) {
+        c->stalled = false;
+        stall_us += time_us_32() - c->stall_start_us;
+    }
+}
+
+static void client_release(client_t* c) {
+    stall_end(c);
+    c->pcb = NULL;
+}
+
+static void client_drop(client_t* c) {
+    tcp_arg(c->pcb, NULL);
+    tcp_sent(c->pcb, NULL);
+    tcp_recv(c->pcb, NULL);
+    tcp_err(c->pcb, NULL);
+    tcp_abort(c->pcb);
+
+    client_release(c);
+    dropped_clients += 1;
+}
+
+// Moves a client that fell behind to the record about to be written. Bytes
+// already in flight still have to be acknowledged before the jump.
+static void client_skip(client_t* c, stream_ring_t* ring) {
+    const uint32_t records = (ring->head - c->sent) / ring->record_size;
+
+    if (c->sent == c->acked) {
+        c->acked = ring->head;
+    } else {
+        c->skip_pending = true;
+        c->skip_from = c->sent;
+        c->skip_to = ring->head;
+    }
+
+    c->sent = ring->head;
+    c->skipped += records;
+    skipped += records;
+}
+
+// Makes room for a new record: slow clients are decimated, then clients
+// still holding the space it needs are dropped so the others keep going.
+static void ring_reserve(stream_ring_t* ring, uint32_t len) {
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_t* c = &clients[i];
+
+        if (c->pcb == NULL || ring_for(c->mode) != ring) {
+            continue;
+        }
+
+        if (ring->record_size && c->record_pos == 0 && !c->skip_pending &&
+            ring->head - c->sent >= DECIMATE_BACKLOG * ring->record_size) {
+            client_skip(c, ring);
+        }
+
+        if (ring->size - (ring->head - c->acked) < len) {
+            client_drop(c);
+        }
+    }
+}
+
+static void client_set_profile(client_t* c, send_profile_t profile) {
+    c->profile = profile;
+
+    if (profile == PROFILE_LATENCY) {
+        tcp_nagle_disable(c->pcb);
+        c->flush_bytes = 1;
+        c->flush_ms = 0;
+    } else {
+        tcp_nagle_enable(c->pcb);
+        c->flush_bytes = TCP_MSS;
+        c->flush_ms = SEND_FLUSH_MS;
+    }
+}
+
+// Replaces the coalescing of the profile, Nagle stays as the profile set it.
+static void client_set_flush(client_t* c, uint32_t bytes, uint32_t ms) {
+    c->flush_bytes = MIN(MAX(bytes, 1), TCP_SND_BUF);
+    c->flush_ms = ms;
+}
+
+// "F<bytes>,<ms>" sets the coalescing, any other character ends it.
+// Returns true when the character belongs to the command.
+static bool client_parse_flush(client_t* c, uint8_t ch) {
+    if (ch >= '0' && ch <= '9') {
+        uint32_t* arg = &c->cmd_args[c->cmd_arg];
+        *arg = MIN(*arg * 10 + (ch - '0'), 1000000);
+        return true;
+    }
+
+    if (ch == ',' && c->cmd_arg == 0) {
+        c->cmd_arg = 1;
+        return true;
+    }
+
+    if (c->cmd_arg == 1) {
+        client_set_flush(c, c->cmd_args[0], c->cmd_args[1]);
+    }
+    c->cmd = 0;
+
+    return false;
+}
+
+static void client_send(client_t* c) {
+    if (c->pcb == NULL) {
+        return;
+    }
+
+    if (c->next_mode != c->mode && c->sent == c->acked) {
+        c->mode = c->next_mode;
+        c->sent = c->acked = ring_for(c->mode)->head;
+        c->record_pos = 0;
+    }
+
+    stream_ring_t* ring = ring_for(c->mode);
+    const uint32_t now = to_ms_since_boot(get_absolute_time());
+    bool written = false;
+
+    // The deadline runs from the oldest byte that isn't written yet.
+    if (c->sent != ring->head && !c->flush_armed) {
+        c->flush_armed = true;
+        c->flush_deadline = now + c->flush_ms;
+    }
+
+    while (c->sent != ring->head) {
+        const uint32_t unsent = ring->head - c->sent;
+
+        // Small writes wait until they fill flush_bytes or the deadline passes.
+        if (unsent < c->flush_bytes && (int32_t)(now - c->flush_deadline) < 0) {
+            break;
+        }
+
+        const uint32_t offset = c->sent & (ring->size - 1);
+        uint32_t len = MIN(unsent, ring->size - offset);
+
+        // Pacing comes from the send buffer, tcp_sent() resumes the stream.
+        const u16_t space = tcp_sndbuf(c->pcb);
+        if (space < MIN(len, TCP_MSS) || tcp_sndqueuelen(c->pcb) + 2 > TCP_SND_QUEUELEN) {
+            stall_begin(c);
+            break;
+        }
+
+        len = MIN(len, space);
+        const u8_t flags = (len < unsent) ? TCP_WRITE_FLAG_MORE : 0;
+        if (tcp_write(c->pcb, ring->data + offset, len, flags) != ERR_OK) {
+            stall_begin(c);
+            break;
+        }
+
+        c->sent += len;
+        if (ring->record_size) {
+            c->record_pos = (c->record_pos + len) % ring->record_size;
+        }
+        written = true;
+    }
+
+    if (written) {
+        tcp_output(c->pcb);
+    }
+
+    if (c->sent == ring->head) {
+        c->flush_armed = false;
+    }
+}
+
+static void block_handler(dma_stream_t* stream, dma_stream_block_t* block, void* arg) {
+    const uint16_t* samples = (const uint16_t*)block->data;
+    const uint32_t count = block->len / 2;
+
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+
+    char line[SAMPLE_LINE_MAX];
+    const int len = format_sample(line, sample_to_millidegrees(sum, count));
+
+    ring_reserve(&text_ring, len);
+    ring_write(&text_ring, line, len);
+
+    const stream_block_header_t header = {
+        .magic = BLOCK_MAGIC,
+        .samples = count,
+        .index = block->index,
+    };
+
+    ring_reserve(&binary_ring, BLOCK_RECORD_SIZE);
+    ring_write(&binary_ring, &header, sizeof(header));
+    ring_write(&binary_ring, block->data, block->len);
+}
+
+static uint8_t rpc_stats(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    static server_stats_t stats;
+
+    dma_stream_stats_t stream_stats;
+    dma_stream_get_stats(&stream, &stream_stats);
+
+    uint8_t active = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        active += (clients[i].pcb != NULL);
+    }
+
+    stats.sample_rate = SAMPLE_RATE;
+    stats.clients = active;
+    stats.blocks = stream_stats.blocks;
+    stats.overruns = stream_stats.overruns;
+    stats.dropped_clients = dropped_clients;
+    stats.skipped = skipped;
+    stats.bytes_acked = bytes_acked;
+    stats.stalls = stalls;
+    stats.stall_ms = stall_us / 1000;
+
+    reply->data = &stats;
+    reply->len = sizeof(stats);
+    reply->copy = true;
+
+    return NETWORK_RPC_OK;
+}
+
+static uint8_t rpc_clients(const uint8_t *args, uint16_t len, network_rpc_reply_t *reply, void *arg) {
+    static client_stats_t stats[MAX_CLIENTS];
+
+    const uint32_t now = to_ms_since_boot(get_absolute_time());
+    int n = 0;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_t* c = &clients[i];
+
+        if (c->pcb == NULL) {
+            continue;
+        }
+
+        const uint32_t elapsed = now - c->connected_ms;
+
+        stats[n].mode = c->mode;
+        stats[n].profile = c->profile;
+        stats[n].bytes_acked = c->bytes_acked;
+        stats[n].throughput = elapsed ? (uint64_t)c->bytes_acked * 1000 / elapsed : 0;
+        stats[n].skipped = c->skipped;
+        stats[n].stalls = c->stalls;
+        stats[n].flush_bytes = c->flush_bytes;
+        stats[n].flush_ms = c->flush_ms;
+        n += 1;
+    }
+
+    reply->data = stats;
+    reply->len = n * sizeof(client_stats_t);
+    reply->copy = true;
+
+    return NETWORK_RPC_OK;
+}
+
+// Unacknowledged segments point into the shared ring, which is only protected
+// while the client holds its slot. tcp_close() would keep them queued with no
+// way to tell when lwIP lets go of them, so the connection is reset instead.
+static void srv_close(client_t* c){
+    tcp_arg(c->pcb, NULL);
+    tcp_sent(c->pcb, NULL);
+    tcp_recv(c->pcb, NULL);
+    tcp_err(c->pcb, NULL);
+    tcp_abort(c->pcb);
+
+    client_release(c);
 }
 
 static void srv_err(void *arg, err_t err) {
     // Probably an indication that the client connection went kaput! Stopping stream...
-    srv_close(client);
+    // The pcb was already freed by lwIP.
+    client_release((client_t*)arg);
+}
+
+static err_t srv_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    client_t* c = (client_t*)arg;
+    uint32_t n = len;
+
+    c->bytes_acked += len;
+    bytes_acked += len;
+
+    if (c->skip_pending && n >= c->skip_from - c->acked) {
+        n -= c->skip_from - c->acked;
+        c->acked = c->skip_to;
+        c->skip_pending = false;
+    }
+    c->acked += n;
+
+    stall_end(c);
+    client_send(c);
+
+    return ERR_OK;
 }
 
 static err_t srv_receive(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
-    if (err != ERR_OK && p != NULL) {
+    client_t* c = (client_t*)arg;
+
+    // The client closed the connection.
+    if (p == NULL) {
+        srv_close(c);
+        return ERR_ABRT;
+    }
+
+    if (err != ERR_OK) {
         goto exception;
     }
 
     tcp_recved(pcb, p->tot_len);
-    tcp_sent(pcb, NULL);
 
-    // The connection is closed if the client sends "X".
-    if (((char*)p->payload)[0] == 'X') {
-        srv_close(pcb);
+    // Commands are single characters, several can arrive in one segment.
+    for (u16_t i = 0; i < p->tot_len && c->pcb; i++) {
+        const uint8_t ch = pbuf_get_at(p, i);
+
+        if (c->cmd == 'F' && client_parse_flush(c, ch)) {
+            continue;
+        }
+
+        switch (ch) {
+            // The connection is closed if the client sends "X".
+            case 'X':
+                srv_close(c);
+                break;
+            // Switch to raw samples with "B", back to text with "T".
+            case 'B':
+                c->next_mode = STREAM_BINARY;
+                break;
+            case 'T':
+                c->next_mode = STREAM_TEXT;
+                break;
+            // Send each record right away with "L", full segments with "H".
+            case 'L':
+                client_set_profile(c, PROFILE_LATENCY);
+                break;
+            case 'H':
+                client_set_profile(c, PROFILE_THROUGHPUT);
+                break;
+            // Coalescing of this connection with "F<bytes>,<ms>".
+            case 'F':
+                c->cmd = 'F';
+                c->cmd_arg = 0;
+                c->cmd_args[0] = 0;
+                c->cmd_args[1] = 0;
+                break;
+        }
     }
 
 exception:
     pbuf_free(p);
-    return err;
+    return (c->pcb == NULL) ? ERR_ABRT : ERR_OK;
 }
 
 static err_t srv_accept(void * arg, struct tcp_pcb * pcb, err_t err) {
     if (err != ERR_OK) {
         return err;
     }
-        
+
+    client_t* c = NULL;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].pcb == NULL) {
+            c = &clients[i];
+            break;
+        }
+    }
+
+    if (c == NULL) {
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+
     tcp_setprio(pcb, TCP_PRIO_MAX);
+    tcp_arg(pcb, c);
     tcp_recv(pcb, srv_receive);
+    tcp_sent(pcb, srv_sent);
     tcp_err(pcb, srv_err);
     tcp_poll(pcb, NULL, 4);
 
-    client = pcb;
+    // Start streaming from the next block.
+    const uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    *c = (client_t){
+        .pcb = pcb,
+        .mode = STREAM_TEXT,
+        .next_mode = STREAM_TEXT,
+        .sent = text_ring.head,
+        .acked = text_ring.head,
+        .connected_ms = now,
+    };
 
-    // Start send timer.
-    add_repeating_timer_ms(50, send_timer, NULL, &timer);
+    client_set_profile(c, PROFILE_THROUGHPUT);
 
     return err;
 }
 
+static void init_adc() {
+    adc_init();
+    adc_set_temp_sensor_enabled(true);
+    adc_select_input(4);
+    adc_fifo_setup(
+        true,   // Write to FIFO
+        true,   // Enable DREQ
+        1,      // Trigger DREQ with at least one sample
+        false,  // No ERR bit
+        false   // Keep all 12 bits
+    );
+    adc_set_clkdiv(48000000 / SAMPLE_RATE - 1);
+}
+
 int main(void) {
     // Init network RNDIS stack.
     network_init();
@@ -85,15 +606,47 @@ int main(void) {
     struct tcp_pcb* listen = tcp_listen(pcb);
     tcp_accept(listen, srv_accept);
 
+    // Start stats server.
+    network_rpc_init();
+    network_rpc_register(RPC_METHOD_STATS, rpc_stats, NULL);
+    network_rpc_register(RPC_METHOD_CLIENTS, rpc_clients, NULL);
+
     // Start ADC.
-    adc_init();
-    adc_set_temp_sensor_enabled(true);
-    adc_select_input(4);
+    init_adc();
+
+    // Capture the temperature sensor with DMA, lwIP is never called from an IRQ.
+    dma_stream_config_t cfg = {
+        .dreq = DREQ_ADC,
+        .src = &adc_hw->fifo,
+        .element_size = DMA_SIZE_16,
+        .block_size = BLOCK_SAMPLES,
+        .buffer_count = BLOCK_BUFFERS,
+        .checksum = DMA_STREAM_CHECKSUM_NONE,
+        .irq = DMA_IRQ_0,
+        .notify = network_wake,
+    };
+
+    for (int i = 0; i < BLOCK_BUFFERS; i++) {
+        cfg.buffers[i] = capture_buf[i];
+    }
+
+    if (!dma_stream_init(&stream, &cfg)) {
+        return 1;
+    }
+
+    dma_stream_add_callback(&stream, block_handler, NULL);
+    dma_stream_start(&stream);
+    adc_run(true);
 
     // Listen to events.
     while (1) {
+        dma_stream_service(&stream);
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            client_send(&clients[i]);
+        }
         network_step();
+        network_wait();
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,89 @@
+import os
+import socket
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "../../lib/usb_network_stack"))
+from rpc_client import RpcClient  # noqa: E402
+
+# Reads the binary stream of tcp_server and compares the host-side
+# throughput with the device-side stats.
+#
+#   python3 stream_client.py [host] [seconds]
+
+BLOCK_MAGIC = 0x4B42
+BLOCK_HEADER = struct.Struct("<HHI")
+STATS = struct.Struct("<IBIIIIIII")
+STATS_FIELDS = ("sample_rate", "clients", "blocks", "overruns", "dropped_clients",
+                "skipped", "bytes_acked", "stalls", "stall_ms")
+CLIENT = struct.Struct("<BBIIIIII")
+CLIENT_FIELDS = ("mode", "profile", "bytes_acked", "throughput", "skipped", "stalls",
+                 "flush_bytes", "flush_ms")
+
+RPC_METHOD_STATS = 1
+RPC_METHOD_CLIENTS = 2
+
+
+def recv_exact(sock, size):
+    data = bytearray()
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed")
+        data += chunk
+    return bytes(data)
+
+
+def sync(sock):
+    # Text lines may still arrive until the switch to binary is acknowledged.
+    window = b""
+    while True:
+        window = (window + recv_exact(sock, 1))[-2:]
+        if window == struct.pack("<H", BLOCK_MAGIC):
+            return window + recv_exact(sock, BLOCK_HEADER.size - 2)
+
+
+def main(host="192.168.7.1", seconds="10"):
+    sock = socket.create_connection((host, 7777))
+    sock.sendall(b"B")
+
+    header = sync(sock)
+    start = time.perf_counter()
+    received = 0
+    blocks = 0
+    gaps = 0
+    last = None
+
+    while time.perf_counter() - start < float(seconds):
+        magic, samples, index = BLOCK_HEADER.unpack(header)
+        if magic != BLOCK_MAGIC:
+            raise RuntimeError("out of sync")
+
+        recv_exact(sock, samples * 2)
+        received += BLOCK_HEADER.size + samples * 2
+        blocks += 1
+
+        if last is not None and index != last + 1:
+            gaps += index - last - 1
+        last = index
+
+        header = recv_exact(sock, BLOCK_HEADER.size)
+
+    elapsed = time.perf_counter() - start
+    print(f"Host: {blocks} blocks, {received / elapsed / 1000:.1f} kB/s, {gaps} blocks missing")
+
+    rpc = RpcClient(host)
+    stats = dict(zip(STATS_FIELDS, STATS.unpack(rpc.call(RPC_METHOD_STATS))))
+    print("Device: " + ", ".join(f"{k}={v}" for k, v in stats.items()))
+
+    for n, entry in enumerate(CLIENT.iter_unpack(rpc.call(RPC_METHOD_CLIENTS))):
+        client = dict(zip(CLIENT_FIELDS, entry))
+        print(f"Client {n}: " + ", ".join(f"{k}={v}" for k, v in client.items()))
+
+    sock.sendall(b"X")
+    sock.close()
+
+
+if __name__ == "__main__":
+    main(*sys.argv[1:])
@@ -0,0 +1,120 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+
+// Per-call timing with SysTick cycle counts. SysTick is a 24-bit down counter
+// clocked by the core, it wraps after ~134 ms at 125 MHz, so longer calls are
+// measured with the 64-bit microsecond timer and converted to cycles.
+
+#ifndef BENCH_MAX_SAMPLES
+#define BENCH_MAX_SAMPLES 256
+#endif
+
+#define BENCH_SYSTICK_MASK 0x00FFFFFF
+
+typedef struct {
+    const char* name;
+    uint32_t bytes;                         // Processed per call, 0 if it doesn't apply.
+    uint32_t count;
+    uint32_t samples[BENCH_MAX_SAMPLES];    // Cycles per call.
+    uint32_t start_cycles;
+    uint64_t start_us;
+} bench_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t median;
+    uint32_t p99;
+    uint32_t max;
+} bench_result_t;
+
+static uint32_t bench_clk_mhz;
+
+// Takes over SysTick as a free-running counter.
+void bench_init() {
+    systick_hw->csr = 0;
+    systick_hw->rvr = BENCH_SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+
+    bench_clk_mhz = clock_get_hz(clk_sys) / 1000000;
+}
+
+void bench_reset(bench_t* bench, const char* name, uint32_t bytes) {
+    bench->name = name;
+    bench->bytes = bytes;
+    bench->count = 0;
+}
+
+static inline void bench_begin(bench_t* bench) {
+    bench->start_us = time_us_64();
+    bench->start_cycles = systick_hw->cvr;
+}
+
+static inline void bench_end(bench_t* bench) {
+    const uint32_t end_cycles = systick_hw->cvr;
+    const uint64_t elapsed_us = time_us_64() - bench->start_us;
+
+    uint32_t cycles = (bench->start_cycles - end_cycles) & BENCH_SYSTICK_MASK;
+
+    // Wrapped at least once, the microsecond timer is the only valid count.
+    if (elapsed_us * bench_clk_mhz > BENCH_SYSTICK_MASK / 2) {
+        cycles = elapsed_us * bench_clk_mhz;
+    }
+
+    if (bench->count < BENCH_MAX_SAMPLES) {
+        bench->samples[bench->count++] = cycles;
+    }
+}
+
+// Adds a sample measured by other means, like an interrupt latency.
+void bench_add(bench_t* bench, uint32_t cycles) {
+    if (bench->count < BENCH_MAX_SAMPLES) {
+        bench->samples[bench->count++] = cycles;
+    }
+}
+
+// Sorts the samples in place.
+void bench_result(bench_t* bench, bench_result_t* result) {
+    uint32_t* s = bench->samples;
+    const uint32_t n = bench->count;
+
+    for (uint32_t i = 1; i < n; i++) {
+        const uint32_t v = s[i];
+        uint32_t j = i;
+        while (j > 0 && s[j - 1] > v) {
+            s[j] = s[j - 1];
+            j--;
+        }
+        s[j] = v;
+    }
+
+    result->count = n;
+    result->min = n ? s[0] : 0;
+    result->median = n ? s[n / 2] : 0;
+    result->p99 = n ? s[(n * 99) / 100] : 0;
+    result->max = n ? s[n - 1] : 0;
+}
+
+// One CSV line per benchmark, preceded once by bench_report_header().
+void bench_report_header() {
+    printf("# bench v1 clk_sys_mhz=%u\n", (unsigned)bench_clk_mhz);
+    printf("# name,count,min,median,p99,max,bytes\n");
+}
+
+void bench_report(bench_t* bench) {
+    bench_result_t r;
+    bench_result(bench, &r);
+
+    printf("bench,%s,%u,%u,%u,%u,%u,%u\n", bench->name, (unsigned)r.count, (unsigned)r.min,
+           (unsigned)r.median, (unsigned)r.p99, (unsigned)r.max, (unsigned)bench->bytes);
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef DMA_SNIFF_H
+#define DMA_SNIFF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+
+// The RP2040 has a single sniffer. It observes the reads of one DMA channel,
+// so a checksum is computed by a dedicated channel that reads the buffer and
+// discards the data. The CPU is free while the pass runs (~1 cycle per word).
+
+typedef enum {
+    DMA_SNIFF_SUM16,    // One's complement Internet checksum (RFC 1071) input.
+    DMA_SNIFF_CRC32,    // CRC-32 (IEEE 802.3), same value as zlib's crc32().
+} dma_sniff_mode_t;
+
+typedef struct {
+    uint chan;
+    dma_sniff_mode_t mode;
+    const uint8_t* data;
+    uint32_t len;
+    uint32_t sink;
+} dma_sniff_t;
+
+bool dma_sniff_init(dma_sniff_t* sniff) {
+    int chan = dma_claim_unused_channel(false);
+
+    if (chan < 0) {
+#ifdef DEBUG
+        printf("No free DMA channel for the sniffer.\n");
+#endif
+        return false;
+    }
+
+    sniff->chan = chan;
+    sniff->data = NULL;
+    sniff->len = 0;
+
+    return true;
+}
+
+void dma_sniff_start(dma_sniff_t* sniff, dma_sniff_mode_t mode, const void* data, uint32_t len) {
+    dma_channel_config cfg = dma_channel_get_default_config(sniff->chan);
+
+    sniff->mode = mode;
+    sniff->data = (const uint8_t*)data;
+    sniff->len = len;
+
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_sniff_enable(&cfg, true);
+
+    if (mode == DMA_SNIFF_SUM16) {
+        // Halfword reads give the native-endian 16-bit words lwIP sums.
+        // The trailing byte of an odd length is added by dma_sniff_get_sum16().
+        channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+        dma_sniffer_enable(sniff->chan, DMA_SNIFF_CTRL_CALC_VALUE_SUM, true);
+        dma_hw->sniff_data = 0;
+        len /= 2;
+    } else {
+        // Bit-reversed input with reversed and inverted output is the
+        // reflected CRC-32 used by Ethernet, zlib and Python's binascii.
+        channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+        dma_sniffer_enable(sniff->chan, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+        hw_set_bits(&dma_hw->sniff_ctrl, DMA_SNIFF_CTRL_OUT_REV_BITS | DMA_SNIFF_CTRL_OUT_INV_BITS);
+        dma_hw->sniff_data = 0xFFFFFFFF;
+    }
+
+    if (len == 0) {
+        return;
+    }
+
+    dma_channel_configure(sniff->chan, &cfg,
+        &sniff->sink,   // dst
+        data,           // src
+        len,            // transfer count
+        true            // start now
+    );
+}
+
+bool dma_sniff_busy(dma_sniff_t* sniff) {
+    return dma_channel_is_busy(sniff->chan);
+}
+
+uint16_t dma_sniff_get_sum16(dma_sniff_t* sniff) {
+    dma_channel_wait_for_finish_blocking(sniff->chan);
+
+    uint32_t sum = dma_hw->sniff_data;
+
+    if (sniff->len & 1) {
+        sum += sniff->data[sniff->len - 1];
+    }
+
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+
+    return (uint16_t)sum;
+}
+
+uint32_t dma_sniff_get_crc32(dma_sniff_t* sniff) {
+    dma_channel_wait_for_finish_blocking(sniff->chan);
+
+    // The OUT_REV and OUT_INV transforms are applied when reading the register.
+    return dma_hw->sniff_data;
+}
+
+uint16_t dma_sniff_sum16(dma_sniff_t* sniff, const void* data, uint32_t len) {
+    dma_sniff_start(sniff, DMA_SNIFF_SUM16, data, len);
+    return dma_sniff_get_sum16(sniff);
+}
+
+uint32_t dma_sniff_crc32(dma_sniff_t* sniff, const void* data, uint32_t len) {
+    dma_sniff_start(sniff, DMA_SNIFF_CRC32, data, len);
+    return dma_sniff_get_crc32(sniff);
+}
+
+#endif
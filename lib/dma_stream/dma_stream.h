@@ -0,0 +1,332 @@
+#ifndef DMA_STREAM_H
+#define DMA_STREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "dma_sniff.h"
+
+#ifndef DMA_STREAM_MAX_BUFFERS
+#define DMA_STREAM_MAX_BUFFERS 4
+#endif
+
+#ifndef DMA_STREAM_MAX_CALLBACKS
+#define DMA_STREAM_MAX_CALLBACKS 4
+#endif
+
+// NVIC priority of the DMA IRQ, the lowest by default: the handler only
+// hands the block over, USB and timers must not wait behind it.
+#ifndef DMA_STREAM_IRQ_PRIORITY
+#define DMA_STREAM_IRQ_PRIORITY 0xFF
+#endif
+
+typedef struct dma_stream dma_stream_t;
+
+typedef enum {
+    DMA_STREAM_CHECKSUM_NONE,
+    DMA_STREAM_CHECKSUM_SUM16,  // One's complement sum, ready for udp_send_chksum().
+    DMA_STREAM_CHECKSUM_CRC32,  // Standard CRC-32 for block integrity.
+} dma_stream_checksum_t;
+
+typedef struct {
+    uint8_t* data;
+    uint32_t len;       // Bytes.
+    uint32_t index;     // Sequence number since dma_stream_start().
+    uint32_t checksum;  // Computed by the DMA sniffer, if enabled.
+} dma_stream_block_t;
+
+typedef void (*dma_stream_cb_t)(dma_stream_t* stream, dma_stream_block_t* block, void* arg);
+
+typedef struct {
+    uint dreq;                                  // Pacing of the source (DREQ_ADC, DREQ_PIO0_RX0...).
+    const volatile void* src;                   // Source FIFO, not incremented.
+    enum dma_channel_transfer_size element_size;
+    uint32_t block_size;                        // Elements per block.
+    uint buffer_count;                          // 2 to DMA_STREAM_MAX_BUFFERS.
+    uint8_t* buffers[DMA_STREAM_MAX_BUFFERS];   // One block each.
+    dma_stream_checksum_t checksum;
+    uint irq;                                   // DMA_IRQ_0 or DMA_IRQ_1.
+    void (*notify)(void);                       // Called from the IRQ when a block is ready.
+} dma_stream_config_t;
+
+typedef struct {
+    uint32_t blocks;            // Blocks delivered to the callbacks.
+    uint32_t bytes;
+    uint32_t overruns;          // Blocks overwritten before service() reached them.
+    uint32_t max_pending;       // Peak number of blocks waiting for service().
+    uint32_t service_max_us;    // Slowest pass over the callbacks for one block.
+} dma_stream_stats_t;
+
+struct dma_stream {
+    dma_stream_config_t cfg;
+    uint chan[DMA_STREAM_MAX_BUFFERS];
+    uint32_t block_bytes;
+
+    dma_stream_cb_t cb[DMA_STREAM_MAX_CALLBACKS];
+    void* cb_arg[DMA_STREAM_MAX_CALLBACKS];
+    uint cb_count;
+
+    volatile uint32_t completed;
+    volatile uint32_t serviced;
+
+    dma_sniff_t sniff;
+    volatile bool sniff_busy;
+    volatile uint32_t sniff_index;
+    uint32_t checksums[DMA_STREAM_MAX_BUFFERS];
+
+    bool running;
+    dma_stream_stats_t stats;
+};
+
+// The IRQ handler is shared by every DMA channel, only one stream can be active.
+static dma_stream_t* dma_stream_active;
+
+static void dma_stream_checksum_collect(dma_stream_t* stream) {
+    if (!stream->sniff_busy) {
+        return;
+    }
+
+    const uint b = stream->sniff_index % stream->cfg.buffer_count;
+
+    if (stream->cfg.checksum == DMA_STREAM_CHECKSUM_SUM16) {
+        stream->checksums[b] = dma_sniff_get_sum16(&stream->sniff);
+    } else {
+        stream->checksums[b] = dma_sniff_get_crc32(&stream->sniff);
+    }
+
+    stream->sniff_busy = false;
+}
+
+static void dma_stream_checksum_start(dma_stream_t* stream, uint32_t index) {
+    if (stream->cfg.checksum == DMA_STREAM_CHECKSUM_NONE) {
+        return;
+    }
+
+    // The previous pass ended long ago, a block takes far longer to capture.
+    dma_stream_checksum_collect(stream);
+
+    const dma_sniff_mode_t mode = (stream->cfg.checksum == DMA_STREAM_CHECKSUM_SUM16) ?
+                                      DMA_SNIFF_SUM16 : DMA_SNIFF_CRC32;
+    const uint b = index % stream->cfg.buffer_count;
+
+    dma_sniff_start(&stream->sniff, mode, stream->cfg.buffers[b], stream->block_bytes);
+    stream->sniff_index = index;
+    stream->sniff_busy = true;
+}
+
+static void dma_stream_irq_handler() {
+    dma_stream_t* stream = dma_stream_active;
+    io_rw_32* ints = (stream->cfg.irq == DMA_IRQ_0) ? &dma_hw->ints0 : &dma_hw->ints1;
+    const uint count = stream->cfg.buffer_count;
+
+    // The channels are chained in a ring, so blocks always complete in order.
+    while (true) {
+        const uint b = stream->completed % count;
+        const uint32_t mask = 1u << stream->chan[b];
+
+        if (!(*ints & mask)) {
+            break;
+        }
+
+        *ints = mask;
+        dma_channel_set_write_addr(stream->chan[b], stream->cfg.buffers[b], false);
+        dma_stream_checksum_start(stream, stream->completed);
+
+        stream->completed += 1;
+
+        const uint32_t pending = stream->completed - stream->serviced;
+        if (pending >= count) {
+            stream->stats.overruns += 1;
+        }
+        if (pending > stream->stats.max_pending) {
+            stream->stats.max_pending = pending;
+        }
+
+        if (stream->cfg.notify) {
+            stream->cfg.notify();
+        }
+    }
+}
+
+bool dma_stream_init(dma_stream_t* stream, const dma_stream_config_t* cfg) {
+    if (cfg->buffer_count < 2 || cfg->buffer_count > DMA_STREAM_MAX_BUFFERS) {
+#ifdef DEBUG
+        printf("Invalid buffer count (%d). Valid 2 to %d.\n", cfg->buffer_count, DMA_STREAM_MAX_BUFFERS);
+#endif
+        return false;
+    }
+
+    stream->cfg = *cfg;
+    stream->block_bytes = cfg->block_size << cfg->element_size;
+    stream->cb_count = 0;
+    stream->completed = 0;
+    stream->serviced = 0;
+    stream->sniff_busy = false;
+    stream->running = false;
+    stream->stats = (dma_stream_stats_t){0};
+
+    if (cfg->checksum != DMA_STREAM_CHECKSUM_NONE && !dma_sniff_init(&stream->sniff)) {
+        return false;
+    }
+
+    const uint count = cfg->buffer_count;
+
+    for (uint i = 0; i < count; i++) {
+        stream->chan[i] = dma_claim_unused_channel(true);
+    }
+
+    for (uint i = 0; i < count; i++) {
+        dma_channel_config dma_cfg = dma_channel_get_default_config(stream->chan[i]);
+
+        channel_config_set_transfer_data_size(&dma_cfg, cfg->element_size);
+        channel_config_set_read_increment(&dma_cfg, false);
+        channel_config_set_write_increment(&dma_cfg, true);
+        channel_config_set_dreq(&dma_cfg, cfg->dreq);
+        channel_config_set_chain_to(&dma_cfg, stream->chan[(i + 1) % count]);
+
+        dma_channel_configure(stream->chan[i], &dma_cfg,
+            cfg->buffers[i],    // dst
+            cfg->src,           // src
+            cfg->block_size,    // transfer count
+            false               // start now
+        );
+
+        if (cfg->irq == DMA_IRQ_0) {
+            dma_channel_set_irq0_enabled(stream->chan[i], true);
+        } else {
+            dma_channel_set_irq1_enabled(stream->chan[i], true);
+        }
+    }
+
+    dma_stream_active = stream;
+    irq_add_shared_handler(cfg->irq, dma_stream_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_priority(cfg->irq, DMA_STREAM_IRQ_PRIORITY);
+    irq_set_enabled(cfg->irq, true);
+
+    return true;
+}
+
+// Callbacks run in order from dma_stream_service(), once per block.
+bool dma_stream_add_callback(dma_stream_t* stream, dma_stream_cb_t cb, void* arg) {
+    if (stream->cb_count >= DMA_STREAM_MAX_CALLBACKS) {
+        return false;
+    }
+
+    stream->cb[stream->cb_count] = cb;
+    stream->cb_arg[stream->cb_count] = arg;
+    stream->cb_count += 1;
+
+    return true;
+}
+
+// The source (adc_run(), PIO SM...) should be started after this call.
+void dma_stream_start(dma_stream_t* stream) {
+    if (stream->running) {
+        return;
+    }
+
+    for (uint i = 0; i < stream->cfg.buffer_count; i++) {
+        dma_channel_set_write_addr(stream->chan[i], stream->cfg.buffers[i], false);
+        dma_channel_set_trans_count(stream->chan[i], stream->cfg.block_size, false);
+    }
+
+    stream->completed = 0;
+    stream->serviced = 0;
+    stream->sniff_busy = false;
+    stream->running = true;
+
+    dma_channel_start(stream->chan[0]);
+}
+
+// The source should be stopped before this call.
+void dma_stream_stop(dma_stream_t* stream) {
+    if (!stream->running) {
+        return;
+    }
+
+    uint32_t mask = 0;
+    for (uint i = 0; i < stream->cfg.buffer_count; i++) {
+        mask |= 1u << stream->chan[i];
+    }
+
+    // Aborting a channel with its IRQ enabled raises a spurious IRQ (RP2040-E13).
+    io_rw_32* inte = (stream->cfg.irq == DMA_IRQ_0) ? &dma_hw->inte0 : &dma_hw->inte1;
+    io_rw_32* ints = (stream->cfg.irq == DMA_IRQ_0) ? &dma_hw->ints0 : &dma_hw->ints1;
+
+    hw_clear_bits(inte, mask);
+    dma_hw->abort = mask;
+    while (dma_hw->abort & mask) {
+        tight_loop_contents();
+    }
+    *ints = mask;
+    hw_set_bits(inte, mask);
+
+    stream->running = false;
+}
+
+// Runs the callbacks over every pending block; returns the number of blocks processed.
+uint dma_stream_service(dma_stream_t* stream) {
+    const uint count = stream->cfg.buffer_count;
+    uint processed = 0;
+
+    while (stream->serviced != stream->completed) {
+        // The oldest pending block is being overwritten, skip to the oldest valid one.
+        if (stream->completed - stream->serviced >= count) {
+            stream->serviced = stream->completed - (count - 1);
+            continue;
+        }
+
+        const uint32_t index = stream->serviced;
+        const uint b = index % count;
+
+        dma_stream_block_t block = {
+            .data = stream->cfg.buffers[b],
+            .len = stream->block_bytes,
+            .index = index,
+            .checksum = 0,
+        };
+
+        if (stream->cfg.checksum != DMA_STREAM_CHECKSUM_NONE) {
+            uint32_t ints = save_and_disable_interrupts();
+            if (stream->sniff_busy && stream->sniff_index == index) {
+                dma_stream_checksum_collect(stream);
+            }
+            restore_interrupts(ints);
+
+            block.checksum = stream->checksums[b];
+        }
+
+        const uint32_t start = time_us_32();
+
+        for (uint i = 0; i < stream->cb_count; i++) {
+            stream->cb[i](stream, &block, stream->cb_arg[i]);
+        }
+
+        const uint32_t elapsed = time_us_32() - start;
+        if (elapsed > stream->stats.service_max_us) {
+            stream->stats.service_max_us = elapsed;
+        }
+
+        stream->serviced = index + 1;
+        stream->stats.blocks += 1;
+        stream->stats.bytes += block.len;
+        processed += 1;
+    }
+
+    return processed;
+}
+
+bool dma_stream_is_running(dma_stream_t* stream) {
+    return stream->running;
+}
+
+void dma_stream_get_stats(dma_stream_t* stream, dma_stream_stats_t* stats) {
+    *stats = stream->stats;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef DMA_STREAM_UDP_H
+#define DMA_STREAM_UDP_H
+
+#include "lwip/udp.h"
+#include "usb_network_pools.h"
+#include "dma_stream.h"
+
+#if !LWIP_CHECKSUM_ON_COPY
+#error "dma_stream_udp.h sends with udp_send_chksum(), build the app with LWIP_CHECKSUM_ON_COPY=1"
+#endif
+
+// UDP sink for a DMA stream. Each block is captured straight into the payload
+// of its own pbuf and sent without a copy; with DMA_STREAM_CHECKSUM_SUM16 the
+// payload checksum comes from the DMA sniffer.
+
+typedef struct {
+    struct udp_pcb* pcb;
+    struct pbuf* pbufs[DMA_STREAM_MAX_BUFFERS];
+    uint32_t sent;
+    uint32_t errors;
+} dma_stream_udp_t;
+
+// Allocates the block buffers of the stream config and connects to the destination.
+bool dma_stream_udp_init(dma_stream_udp_t* udp, dma_stream_config_t* cfg,
+                         const ip_addr_t* addr, u16_t port) {
+    const uint32_t block_bytes = cfg->block_size << cfg->element_size;
+
+    udp->sent = 0;
+    udp->errors = 0;
+
+    for (uint i = 0; i < cfg->buffer_count; i++) {
+        udp->pbufs[i] = network_stream_alloc(PBUF_RAW, block_bytes);
+
+        if (udp->pbufs[i] == NULL) {
+            return false;
+        }
+
+        cfg->buffers[i] = (uint8_t*)udp->pbufs[i]->payload;
+    }
+
+    udp->pcb = udp_new();
+
+    if (udp->pcb == NULL) {
+        return false;
+    }
+
+    return udp_connect(udp->pcb, addr, port) == ERR_OK;
+}
+
+// Block callback, register it with dma_stream_add_callback().
+void dma_stream_udp_send(dma_stream_t* stream, dma_stream_block_t* block, void* arg) {
+    dma_stream_udp_t* udp = (dma_stream_udp_t*)arg;
+    struct pbuf* p = udp->pbufs[block->index % stream->cfg.buffer_count];
+    err_t err;
+
+    if (stream->cfg.checksum == DMA_STREAM_CHECKSUM_SUM16) {
+        err = udp_send_chksum(udp->pcb, p, 1, (u16_t)block->checksum);
+    } else {
+        err = udp_send(udp->pcb, p);
+    }
+
+    if (err == ERR_OK) {
+        udp->sent += 1;
+    } else {
+        udp->errors += 1;
+    }
+}
+
+#endif
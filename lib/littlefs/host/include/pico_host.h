@@ -0,0 +1,165 @@
+#ifndef PICO_HOST_H
+#define PICO_HOST_H
+
+// The parts of the pico-sdk used by lfs_rp2040.c, mapped to the NOR flash
+// emulator so the port builds and runs unchanged on the host.
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nor_flash.h"
+
+typedef unsigned int uint;
+
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+#define PICO_ERROR_NOT_PERMITTED -4
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define FLASH_BLOCK_SIZE (1u << 16)
+
+// The largest flash the emulator accepts.
+#ifndef PICO_FLASH_SIZE_BYTES
+#define PICO_FLASH_SIZE_BYTES (16 * 1024 * 1024)
+#endif
+
+// Every XIP alias reads the emulated flash directly.
+#define XIP_BASE ((uintptr_t)nor_flash_xip)
+#define XIP_NOALLOC_BASE XIP_BASE
+#define XIP_NOCACHE_NOALLOC_BASE XIP_BASE
+
+// The "binary" occupies the reserved bytes at the start of the flash.
+#define LFS_RP2040_BINARY_END (XIP_BASE + nor_flash_reserved())
+
+#define __not_in_flash_func(name) name
+
+#ifndef MIN
+#define MIN(a, b) ((b) < (a) ? (b) : (a))
+#endif
+
+static inline void tight_loop_contents() {}
+
+// Interrupts
+
+static inline uint32_t save_and_disable_interrupts() {
+    return 0;
+}
+
+static inline void restore_interrupts(uint32_t status) {}
+
+// Flash
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+
+void flash_do_cmd(const uint8_t *txbuf, uint8_t *rxbuf, size_t count);
+
+// There is no other core, the operation runs in the caller's thread.
+static inline int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms) {
+    func(param);
+    return PICO_OK;
+}
+
+// Time, including the simulated flash time when the emulator doesn't sleep.
+
+static inline uint64_t time_us_64() {
+    return nor_flash_time_us();
+}
+
+static inline uint32_t time_us_32() {
+    return (uint32_t)nor_flash_time_us();
+}
+
+static inline void sleep_us(uint64_t us) {
+    nor_flash_sleep_us(us);
+}
+
+static inline void sleep_ms(uint32_t ms) {
+    nor_flash_sleep_us((uint64_t)ms * 1000);
+}
+
+// DMA: no channel is ever available, bulk reads use memcpy.
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+    uint32_t ctrl;
+} dma_channel_config;
+
+static inline int dma_claim_unused_channel(bool required) {
+    return -1;
+}
+
+static inline dma_channel_config dma_channel_get_default_config(uint channel) {
+    return (dma_channel_config){0};
+}
+
+static inline void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) {}
+
+static inline void channel_config_set_read_increment(dma_channel_config *c, bool incr) {}
+
+static inline void channel_config_set_write_increment(dma_channel_config *c, bool incr) {}
+
+static inline void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                                         const volatile void *read_addr, uint transfer_count, bool trigger) {}
+
+static inline void dma_channel_wait_for_finish_blocking(uint channel) {}
+
+// Sniffer: never reached without a channel, checksums use software.
+
+#define DMA_SNIFF_CTRL_CALC_VALUE_SUM 0xf
+#define DMA_SNIFF_CTRL_CALC_VALUE_CRC32R 0x1
+#define DMA_SNIFF_CTRL_OUT_REV_BITS 0x00000400
+#define DMA_SNIFF_CTRL_OUT_INV_BITS 0x00000800
+
+static struct {
+    volatile uint32_t sniff_ctrl;
+    volatile uint32_t sniff_data;
+} *const dma_hw = NULL;
+
+static inline void hw_set_bits(volatile uint32_t *addr, uint32_t mask) {}
+
+static inline void channel_config_set_sniff_enable(dma_channel_config *c, bool sniff_enable) {}
+
+static inline void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable) {}
+
+static inline bool dma_channel_is_busy(uint channel) {
+    return false;
+}
+
+// Mutex
+
+typedef struct {
+    pthread_mutex_t mutex;
+    bool initialized;
+} recursive_mutex_t;
+
+static inline void recursive_mutex_init(recursive_mutex_t *mtx) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mtx->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    mtx->initialized = true;
+}
+
+static inline bool recursive_mutex_is_initialized(recursive_mutex_t *mtx) {
+    return mtx->initialized;
+}
+
+static inline void recursive_mutex_enter_blocking(recursive_mutex_t *mtx) {
+    pthread_mutex_lock(&mtx->mutex);
+}
+
+static inline void recursive_mutex_exit(recursive_mutex_t *mtx) {
+    pthread_mutex_unlock(&mtx->mutex);
+}
+
+#endif
@@ -0,0 +1,235 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pico_host.h"
+
+uint8_t* nor_flash_xip;
+
+static struct {
+    nor_flash_config_t cfg;
+    nor_flash_stats_t stats;
+    int fd;
+    uint64_t idle_us;
+    uint32_t cut_after;
+    bool power_lost;
+} _nor_flash = { .fd = -1 };
+
+static void nor_flash_wait(uint64_t us) {
+    if (_nor_flash.cfg.sleep && us) {
+        const struct timespec ts = { .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void nor_flash_busy(uint64_t us) {
+    _nor_flash.stats.busy_us += us;
+    nor_flash_wait(us);
+}
+
+// Returns false when the operation is lost to a power cut. The one that
+// trips it is still applied in part by the caller.
+static bool nor_flash_powered(bool* cut) {
+    *cut = false;
+
+    if (_nor_flash.power_lost) {
+        return false;
+    }
+
+    if (_nor_flash.cut_after && --_nor_flash.cut_after == 0) {
+        _nor_flash.power_lost = true;
+        *cut = true;
+    }
+
+    return true;
+}
+
+static void nor_flash_check(uint32_t offs, size_t count, uint32_t align, const char* op) {
+    if (offs % align || count % align || offs + count > _nor_flash.cfg.size) {
+        fprintf(stderr, "nor_flash: invalid %s at 0x%08x, %zu bytes\n", op, offs, count);
+        abort();
+    }
+}
+
+bool nor_flash_open(const nor_flash_config_t* cfg) {
+    if (cfg->size == 0 || cfg->size & (cfg->size - 1) || cfg->size > PICO_FLASH_SIZE_BYTES ||
+        cfg->reserved >= cfg->size) {
+        return false;
+    }
+
+    nor_flash_close();
+    _nor_flash.cfg = *cfg;
+
+    if (cfg->path == NULL) {
+        nor_flash_xip = aligned_alloc(FLASH_BLOCK_SIZE, cfg->size);
+        if (nor_flash_xip == NULL) {
+            return false;
+        }
+        memset(nor_flash_xip, 0xFF, cfg->size);
+        return true;
+    }
+
+    _nor_flash.fd = open(cfg->path, O_RDWR | O_CREAT, 0644);
+    if (_nor_flash.fd < 0) {
+        return false;
+    }
+
+    // A new image starts erased, an existing one must have the same size.
+    const off_t size = lseek(_nor_flash.fd, 0, SEEK_END);
+    if (size == 0) {
+        uint8_t erased[FLASH_SECTOR_SIZE];
+        memset(erased, 0xFF, sizeof(erased));
+        for (uint32_t i = 0; i < cfg->size; i += sizeof(erased)) {
+            if (write(_nor_flash.fd, erased, sizeof(erased)) != sizeof(erased)) {
+                nor_flash_close();
+                return false;
+            }
+        }
+    } else if (size != cfg->size) {
+        nor_flash_close();
+        return false;
+    }
+
+    void* map = mmap(NULL, cfg->size, PROT_READ | PROT_WRITE, MAP_SHARED, _nor_flash.fd, 0);
+    if (map == MAP_FAILED) {
+        nor_flash_close();
+        return false;
+    }
+
+    nor_flash_xip = map;
+    return true;
+}
+
+void nor_flash_close() {
+    if (_nor_flash.fd >= 0) {
+        if (nor_flash_xip) {
+            munmap(nor_flash_xip, _nor_flash.cfg.size);
+        }
+        close(_nor_flash.fd);
+    } else {
+        free(nor_flash_xip);
+    }
+
+    nor_flash_xip = NULL;
+    _nor_flash.fd = -1;
+    _nor_flash.cut_after = 0;
+    _nor_flash.power_lost = false;
+    memset(&_nor_flash.stats, 0, sizeof(_nor_flash.stats));
+}
+
+uint32_t nor_flash_reserved() {
+    return _nor_flash.cfg.reserved;
+}
+
+uint64_t nor_flash_time_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    const uint64_t now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    return _nor_flash.cfg.sleep ? now : now + _nor_flash.stats.busy_us + _nor_flash.idle_us;
+}
+
+void nor_flash_sleep_us(uint64_t us) {
+    _nor_flash.idle_us += us;
+    nor_flash_wait(us);
+}
+
+void nor_flash_get_stats(nor_flash_stats_t* stats) {
+    *stats = _nor_flash.stats;
+}
+
+void nor_flash_reset_stats() {
+    // The clock must not go back.
+    const uint64_t busy_us = _nor_flash.stats.busy_us;
+
+    memset(&_nor_flash.stats, 0, sizeof(_nor_flash.stats));
+    _nor_flash.stats.busy_us = busy_us;
+}
+
+void nor_flash_cut_power_after(uint32_t ops) {
+    _nor_flash.cut_after = ops;
+}
+
+bool nor_flash_power_lost() {
+    return _nor_flash.power_lost;
+}
+
+void nor_flash_power_on() {
+    _nor_flash.power_lost = false;
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    nor_flash_check(flash_offs, count, FLASH_PAGE_SIZE, "program");
+
+    bool cut;
+    if (!nor_flash_powered(&cut)) {
+        return;
+    }
+
+    // A cut program leaves the later half of the pages untouched.
+    if (cut) {
+        count = (count / FLASH_PAGE_SIZE / 2) * FLASH_PAGE_SIZE;
+    }
+
+    uint8_t* dst = nor_flash_xip + flash_offs;
+
+    for (size_t page = 0; page < count; page += FLASH_PAGE_SIZE) {
+        bool overwrite = false;
+
+        for (size_t i = page; i < page + FLASH_PAGE_SIZE; i++) {
+            overwrite |= dst[i] != 0xFF;
+            dst[i] &= data[i];
+        }
+
+        _nor_flash.stats.overwrites += overwrite;
+        _nor_flash.stats.pages += 1;
+        nor_flash_busy(_nor_flash.cfg.latency.prog_us);
+    }
+
+    _nor_flash.stats.programs += 1;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    nor_flash_check(flash_offs, count, FLASH_SECTOR_SIZE, "erase");
+
+    bool cut;
+    if (!nor_flash_powered(&cut)) {
+        return;
+    }
+
+    // Like the SDK, aligned 64 KB ranges use the block erase command.
+    for (uint32_t offs = flash_offs; offs < flash_offs + count;) {
+        const bool block = offs % FLASH_BLOCK_SIZE == 0 && flash_offs + count - offs >= FLASH_BLOCK_SIZE;
+        const uint32_t size = block ? FLASH_BLOCK_SIZE : FLASH_SECTOR_SIZE;
+
+        // A cut erase leaves the first sector half erased.
+        if (cut) {
+            memset(nor_flash_xip + offs, 0xFF, FLASH_SECTOR_SIZE / 2);
+            return;
+        }
+
+        memset(nor_flash_xip + offs, 0xFF, size);
+
+        if (block) {
+            _nor_flash.stats.erases_64k += 1;
+            nor_flash_busy(_nor_flash.cfg.latency.erase_64k_us);
+        } else {
+            _nor_flash.stats.erases += 1;
+            nor_flash_busy(_nor_flash.cfg.latency.erase_us);
+        }
+
+        offs += size;
+    }
+}
+
+void flash_do_cmd(const uint8_t *txbuf, uint8_t *rxbuf, size_t count) {
+    memset(rxbuf, 0, count);
+
+    // JEDEC ID: manufacturer, type and log2 of the capacity.
+    if (txbuf[0] == 0x9f && count >= 4) {
+        rxbuf[1] = 0xEF;
+        rxbuf[2] = 0x40;
+        rxbuf[3] = __builtin_ctz(_nor_flash.cfg.size);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef NOR_FLASH_H
+#define NOR_FLASH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A QSPI NOR flash like the one of the Pico, in RAM or in a file:
+// erase sets a 4 KB sector (or an aligned 64 KB block) to 0xFF and a
+// program can only clear bits of 256 byte pages.
+
+typedef struct {
+    uint32_t prog_us;           // Per 256 byte page.
+    uint32_t erase_us;          // Per 4 KB sector.
+    uint32_t erase_64k_us;      // Per aligned 64 KB block.
+} nor_flash_latency_t;
+
+// Typical figures of the W25Q16JV of the Pico.
+#define NOR_FLASH_LATENCY_W25Q16 ((nor_flash_latency_t){ \
+    .prog_us = 400, .erase_us = 45000, .erase_64k_us = 150000 })
+
+typedef struct {
+    const char* path;           // Backing file, NULL keeps the flash in RAM.
+    uint32_t size;              // Flash size in bytes, a power of two.
+    uint32_t reserved;          // Bytes taken by the binary before the filesystem.
+    nor_flash_latency_t latency;
+    bool sleep;                 // Sleep for the latencies instead of only adding them to the clock.
+} nor_flash_config_t;
+
+typedef struct {
+    uint32_t programs;          // flash_range_program() calls.
+    uint32_t pages;             // Pages programmed.
+    uint32_t erases;            // 4 KB sector erases.
+    uint32_t erases_64k;        // 64 KB block erases.
+    uint32_t overwrites;        // Pages programmed over bytes that weren't erased.
+    uint64_t busy_us;           // Simulated time spent programming and erasing.
+} nor_flash_stats_t;
+
+// Base of the emulated XIP window.
+extern uint8_t* nor_flash_xip;
+
+bool nor_flash_open(const nor_flash_config_t* cfg);
+
+void nor_flash_close();
+
+uint32_t nor_flash_reserved();
+
+// Monotonic clock in microseconds. Without sleep, the simulated flash time
+// is added, so timings measured with it include the flash latencies.
+uint64_t nor_flash_time_us();
+
+// Waits like sleep_us() on the device. Without sleep, only the clock moves.
+void nor_flash_sleep_us(uint64_t us);
+
+void nor_flash_get_stats(nor_flash_stats_t* stats);
+
+void nor_flash_reset_stats();
+
+// Power loss: the `ops`-th program or erase from now is cut half way and
+// later ones are ignored until nor_flash_power_on(). Zero disables it.
+void nor_flash_cut_power_after(uint32_t ops);
+
+bool nor_flash_power_lost();
+
+// Back on after a power loss. The port must be initialized and the
+// filesystem mounted again, like after a reset.
+void nor_flash_power_on();
+
+#endif
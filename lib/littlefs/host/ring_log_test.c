@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lfs_rp2040.h"
+#include "ring_log.h"
+
+// Reboots the ring log on the emulated flash and reads it back: the head
+// search after several wraps, a power cut while erasing sector 0 to wrap
+// around, and random power cuts that tear records. After every reboot the
+// records must be intact and consecutive, and none that was synced may be
+// lost. Exits with an error on any mismatch.
+//
+//   ./ring_log_test [cuts]
+
+#define FLASH_SIZE (2 * 1024 * 1024)
+#define REGION_POS (1024 * 1024)
+#define SECTORS 16
+#define MAX_FILLER 60
+// Records of the largest size that fill a sector.
+#define MIN_RECORDS_PER_SECTOR ((RING_LOG_SECTOR_SIZE - sizeof(ring_log_header_t)) / \
+                                (sizeof(ring_log_record_t) + 4 + MAX_FILLER))
+
+static ring_log_t ring;
+static uint32_t appended;       // Records appended, the next one is numbered so.
+static uint32_t synced;         // Records that must survive a reboot.
+static uint32_t torn;
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures += 1; \
+    } \
+} while (0)
+
+// Record n: its number, then n % MAX_FILLER bytes derived from it.
+static uint16_t make_record(uint32_t n, uint8_t* out) {
+    const uint16_t size = 4 + n % MAX_FILLER;
+
+    memcpy(out, &n, 4);
+    for (uint16_t i = 4; i < size; i++) {
+        out[i] = n * 7 + i;
+    }
+
+    return size;
+}
+
+static bool append_record() {
+    uint8_t record[4 + MAX_FILLER];
+    const uint16_t size = make_record(appended, record);
+
+    if (!ring_log_append(&ring, record, size)) {
+        return false;
+    }
+
+    appended += 1;
+    return true;
+}
+
+static bool sync_records() {
+    if (!ring_log_sync(&ring) || nor_flash_power_lost()) {
+        return false;
+    }
+
+    synced = appended;
+    return true;
+}
+
+// Initializes the log again, as after a reset, and reads it back. With
+// `full`, nothing was torn and the ring must hold at least every sector
+// but the head and the oldest one. Appends continue after the last record.
+static void reboot(bool full) {
+    CHECK(ring_log_init(&ring, REGION_POS, SECTORS * RING_LOG_SECTOR_SIZE));
+    torn += ring.stats.torn;
+
+    uint32_t count = 0;
+    uint32_t last = 0;
+
+    ring_log_cursor_t cursor;
+    const uint8_t* data;
+    uint16_t size;
+
+    if (ring_log_first(&ring, &cursor)) {
+        while (ring_log_next(&ring, &cursor, &data, &size)) {
+            uint32_t n;
+            memcpy(&n, data, 4);
+
+            uint8_t expected[4 + MAX_FILLER];
+            if (size != make_record(n, expected) || memcmp(data, expected, size) != 0) {
+                printf("record %u damaged\n", n);
+                failures += 1;
+                break;
+            }
+
+            if (count && n != last + 1) {
+                printf("record %u follows %u\n", n, last);
+                failures += 1;
+                break;
+            }
+
+            last = n;
+            count += 1;
+        }
+    }
+
+    if (synced) {
+        CHECK(count > 0 && last + 1 >= synced);
+    }
+    if (count) {
+        CHECK(last + 1 <= appended);
+    }
+    if (full) {
+        const uint32_t bound = (SECTORS - 2) * MIN_RECORDS_PER_SECTOR;
+        CHECK(count >= (synced < bound ? synced : bound));
+    }
+
+    if (count) {
+        synced = appended = last + 1;
+    } else {
+        synced = 0;
+    }
+}
+
+// Appends over three wraps and reboots now and then, synced or not.
+static void test_wraps() {
+    CHECK(ring_log_init(&ring, REGION_POS, SECTORS * RING_LOG_SECTOR_SIZE));
+    CHECK(ring_log_format(&ring));
+    appended = synced = 0;
+
+    const uint32_t total = 3 * SECTORS * RING_LOG_SECTOR_SIZE / (sizeof(ring_log_record_t) + 4 + MAX_FILLER / 2);
+    uint32_t wraps = 0;
+
+    while (appended < total) {
+        const uint32_t head = ring.head;
+        CHECK(append_record());
+        wraps += ring.head < head;
+
+        if (appended % 7 == 0) {
+            CHECK(sync_records());
+        }
+        if (appended % 500 == 0) {
+            CHECK(sync_records());
+            const uint32_t before = appended;
+            reboot(true);
+            CHECK(appended == before);
+        } else if (appended % 777 == 0) {
+            // Unsynced records may be lost, the synced ones not.
+            reboot(false);
+        }
+    }
+
+    CHECK(sync_records());
+    reboot(true);
+    CHECK(wraps >= 2);
+
+    printf("wraps: %u records, %u wraps\n", appended, wraps);
+}
+
+// The power goes while the last sector is full and sector 0 is erased to
+// wrap around. The head is the last sector until sector 0 is reused.
+static void test_cut_erasing_sector_0() {
+    CHECK(ring_log_init(&ring, REGION_POS, SECTORS * RING_LOG_SECTOR_SIZE));
+    CHECK(ring_log_format(&ring));
+    appended = synced = 0;
+
+    // Until the next record opens sector 0 again.
+    while (true) {
+        CHECK(append_record());
+        CHECK(sync_records());
+
+        const uint16_t size = 4 + appended % MAX_FILLER;
+        if (ring.head == SECTORS - 1 &&
+            ring.offset + sizeof(ring_log_record_t) + size > RING_LOG_SECTOR_SIZE) {
+            break;
+        }
+    }
+
+    // The head is synced, the next operation is the erase of sector 0.
+    const uint32_t durable = synced;
+    nor_flash_cut_power_after(1);
+    append_record();
+    CHECK(nor_flash_power_lost());
+    nor_flash_power_on();
+
+    reboot(false);
+    CHECK(ring.head == SECTORS - 1);
+    CHECK(appended == durable);
+
+    // Appends wrap into sector 0 and everything is read back.
+    for (int i = 0; i < 50; i++) {
+        CHECK(append_record());
+    }
+    CHECK(sync_records());
+    CHECK(ring.head == 0);
+    reboot(false);
+    CHECK(ring.head == 0);
+
+    printf("cut erasing sector 0: %u records\n", appended);
+}
+
+// Random power cuts between syncs, torn records are dropped at boot.
+static void test_power_cuts(uint32_t cuts) {
+    CHECK(ring_log_init(&ring, REGION_POS, SECTORS * RING_LOG_SECTOR_SIZE));
+    CHECK(ring_log_format(&ring));
+    appended = synced = 0;
+    torn = 0;
+
+    srand(1);
+
+    for (uint32_t cut = 0; cut < cuts; cut++) {
+        nor_flash_cut_power_after(rand() % 40 + 1);
+
+        while (!nor_flash_power_lost()) {
+            append_record();
+            if (rand() % 8 == 0) {
+                sync_records();
+            }
+        }
+
+        nor_flash_power_on();
+        reboot(false);
+    }
+
+    CHECK(torn > 0);
+
+    printf("power cuts: %u cuts, %u records, %u torn\n", cuts, appended, torn);
+}
+
+int main(int argc, char** argv) {
+    const uint32_t cuts = argc > 1 ? atoi(argv[1]) : 500;
+
+    const nor_flash_config_t flash = {
+        .size = FLASH_SIZE,
+        .reserved = 256 * 1024,
+    };
+
+    if (!nor_flash_open(&flash)) {
+        return 1;
+    }
+
+    test_wraps();
+    test_cut_erasing_sector_0();
+    test_power_cuts(cuts);
+
+    nor_flash_close();
+
+    printf("%d failures\n", failures);
+
+    return failures ? 1 : 0;
+}
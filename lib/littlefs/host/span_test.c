@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "lfs_rp2040.h"
+
+// lfs_rp2040_file_span() walks the CTZ skip-list of LittleFS on its own.
+// Files of one to a few hundred blocks are written, so the walk takes every
+// skip length, and each span is compared with lfs_file_read() at the block
+// boundaries and at positions in between. Inline and unsynced files must be
+// refused. Exits with an error on any mismatch.
+//
+//   ./span_test
+
+#define FLASH_SIZE (2 * 1024 * 1024)
+#define STRIDE 509                      // Prime, lands at every offset of a block.
+
+static struct lfs_config cfg;
+static lfs_t lfs;
+static lfs_file_t file;
+static uint8_t buffer[FLASH_SECTOR_SIZE];
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures += 1; \
+    } \
+} while (0)
+
+static uint8_t pattern(uint32_t seed, lfs_off_t pos) {
+    uint32_t x = (pos + 1) * 2654435761u ^ seed;
+    x ^= x >> 15;
+    return x;
+}
+
+static bool write_file(const char* name, uint32_t seed, lfs_size_t size) {
+    if (lfs_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC)) {
+        return false;
+    }
+
+    for (lfs_off_t pos = 0; pos < size; pos += sizeof(buffer)) {
+        const lfs_size_t len = lfs_min(sizeof(buffer), size - pos);
+        for (lfs_size_t i = 0; i < len; i++) {
+            buffer[i] = pattern(seed, pos + i);
+        }
+        if (lfs_file_write(&lfs, &file, buffer, len) != (lfs_ssize_t)len) {
+            return false;
+        }
+    }
+
+    return lfs_file_close(&lfs, &file) == LFS_ERR_OK;
+}
+
+// Compares the span at pos with lfs_file_read(), returns its size.
+static lfs_size_t check_span(lfs_off_t pos, lfs_size_t file_size) {
+    const uint8_t* data = NULL;
+    lfs_size_t size = 0;
+
+    if (lfs_rp2040_file_span(&lfs, &file, pos, &data, &size) != LFS_ERR_OK) {
+        printf("pos %u: span failed\n", pos);
+        failures += 1;
+        return 0;
+    }
+
+    if (size == 0 || size > FLASH_SECTOR_SIZE || pos + size > file_size) {
+        printf("pos %u: span of %u bytes\n", pos, size);
+        failures += 1;
+        return 0;
+    }
+
+    if (lfs_file_seek(&lfs, &file, pos, LFS_SEEK_SET) != (lfs_soff_t)pos ||
+        lfs_file_read(&lfs, &file, buffer, size) != (lfs_ssize_t)size ||
+        memcmp(data, buffer, size) != 0) {
+        printf("pos %u: span of %u bytes differs from lfs_file_read()\n", pos, size);
+        failures += 1;
+    }
+
+    return size;
+}
+
+static void check_file(const char* name, uint32_t seed, lfs_size_t file_size) {
+    CHECK(write_file(name, seed, file_size));
+    CHECK(lfs_file_open(&lfs, &file, name, LFS_O_RDONLY) == LFS_ERR_OK);
+
+    // Span by span: every block start and the last byte of every block.
+    lfs_off_t pos = 0;
+    uint32_t blocks = 0;
+    while (pos < file_size) {
+        const lfs_size_t size = check_span(pos, file_size);
+        if (size == 0) {
+            break;
+        }
+        if (size > 1) {
+            CHECK(check_span(pos + size - 1, file_size) == 1);
+        }
+        pos += size;
+        blocks += 1;
+    }
+    CHECK(pos == file_size);
+
+    // Positions inside the blocks, visited backwards as well.
+    for (lfs_off_t p = 0; p < file_size; p += STRIDE) {
+        check_span(p, file_size);
+        check_span(file_size - 1 - p, file_size);
+    }
+
+    // Past the end: an empty span.
+    const uint8_t* data;
+    lfs_size_t size = 1;
+    CHECK(lfs_rp2040_file_span(&lfs, &file, file_size, &data, &size) == LFS_ERR_OK && size == 0);
+
+    CHECK(lfs_file_close(&lfs, &file) == LFS_ERR_OK);
+
+    printf("%-8s %8u bytes %4u blocks\n", name, file_size, blocks);
+}
+
+int main() {
+    const nor_flash_config_t flash = {
+        .size = FLASH_SIZE,
+        .reserved = 256 * 1024,
+    };
+
+    if (!nor_flash_open(&flash) || !lfs_rp2040_init(&cfg) ||
+        lfs_format(&lfs, &cfg) || lfs_mount(&lfs, &cfg)) {
+        printf("Mount failed\n");
+        return 1;
+    }
+
+    // One block, a few, and enough that the walk back from the head
+    // takes skips of up to 256 blocks.
+    const lfs_size_t sizes[] = {
+        1000,
+        FLASH_SECTOR_SIZE,
+        3 * FLASH_SECTOR_SIZE + 17,
+        40 * FLASH_SECTOR_SIZE + 123,
+        300 * FLASH_SECTOR_SIZE,
+    };
+
+    for (uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "F%u", i);
+        check_file(name, i + 1, sizes[i]);
+        CHECK(lfs_remove(&lfs, name) == LFS_ERR_OK);
+    }
+
+    // Inline files live in the metadata, there is no block to map.
+    const uint8_t* data;
+    lfs_size_t size;
+    CHECK(write_file("INLINE", 7, 100));
+    CHECK(lfs_file_open(&lfs, &file, "INLINE", LFS_O_RDONLY) == LFS_ERR_OK);
+    CHECK(lfs_rp2040_file_span(&lfs, &file, 0, &data, &size) == LFS_ERR_INVAL);
+    CHECK(lfs_file_close(&lfs, &file) == LFS_ERR_OK);
+
+    // Unsynced writes are in the file cache, mapped only after a sync.
+    CHECK(lfs_file_open(&lfs, &file, "DIRTY", LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC) == LFS_ERR_OK);
+    for (lfs_off_t pos = 0; pos < 2 * sizeof(buffer); pos += sizeof(buffer)) {
+        for (lfs_size_t i = 0; i < sizeof(buffer); i++) {
+            buffer[i] = pattern(9, pos + i);
+        }
+        CHECK(lfs_file_write(&lfs, &file, buffer, sizeof(buffer)) == (lfs_ssize_t)sizeof(buffer));
+    }
+    CHECK(lfs_rp2040_file_span(&lfs, &file, 0, &data, &size) == LFS_ERR_INVAL);
+    CHECK(lfs_file_sync(&lfs, &file) == LFS_ERR_OK);
+    CHECK(check_span(0, 2 * sizeof(buffer)) > 0);
+    CHECK(lfs_file_close(&lfs, &file) == LFS_ERR_OK);
+
+    lfs_unmount(&lfs);
+    nor_flash_close();
+
+    printf("%d failures\n", failures);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "lfs_rp2040.h"
+#include "ring_log.h"
+
+// Sustained recording on the emulated flash of the Pico: LittleFS against
+// the raw ring log, for a few sync intervals. Flash latencies are those of
+// the W25Q16, added to the clock without waiting.
+//
+//   ./storage_bench [record_size] [total_kb]
+
+#define FLASH_SIZE (2 * 1024 * 1024)
+#define PARTITION_BLOCKS 128            // 512 KB each.
+
+typedef struct {
+    uint64_t elapsed_us;
+    uint32_t max_us;
+    uint64_t programmed;
+    uint32_t erases;
+} result_t;
+
+static uint8_t record[RING_LOG_MAX_RECORD];
+
+static void flash_begin() {
+    nor_flash_reset_stats();
+}
+
+static void flash_end(result_t* result, uint64_t start_us) {
+    nor_flash_stats_t stats;
+    nor_flash_get_stats(&stats);
+
+    result->elapsed_us = nor_flash_time_us() - start_us;
+    result->programmed = (uint64_t)stats.pages * FLASH_PAGE_SIZE;
+    result->erases = stats.erases + stats.erases_64k * (FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE);
+}
+
+static void track(result_t* result, uint64_t start_us) {
+    const uint32_t elapsed_us = nor_flash_time_us() - start_us;
+    if (elapsed_us > result->max_us) {
+        result->max_us = elapsed_us;
+    }
+}
+
+static bool bench_littlefs(result_t* result, uint32_t size, uint32_t total, uint32_t sync_every) {
+    static struct lfs_config cfg;
+    static lfs_t lfs;
+    static lfs_file_t file;
+
+    lfs_rp2040_params_t params = LFS_RP2040_PRESET_DEFAULT;
+    params.block_count = PARTITION_BLOCKS;
+
+    if (!lfs_rp2040_init_with(&cfg, &params) || lfs_format(&lfs, &cfg) || lfs_mount(&lfs, &cfg)) {
+        return false;
+    }
+
+    lfs_file_open(&lfs, &file, "rec", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+
+    flash_begin();
+    const uint64_t start_us = nor_flash_time_us();
+
+    for (uint32_t n = 0; n < total / size; n++) {
+        const uint64_t call_us = nor_flash_time_us();
+
+        if (lfs_file_write(&lfs, &file, record, size) != (lfs_ssize_t)size) {
+            return false;
+        }
+        if ((n + 1) % sync_every == 0 && lfs_file_sync(&lfs, &file)) {
+            return false;
+        }
+
+        track(result, call_us);
+    }
+
+    lfs_file_close(&lfs, &file);
+    flash_end(result, start_us);
+    lfs_unmount(&lfs);
+
+    return true;
+}
+
+static bool bench_ring_log(result_t* result, uint32_t size, uint32_t total, uint32_t sync_every) {
+    static struct lfs_config cfg;
+    static ring_log_t log;
+
+    // The ring log takes the flash after the LittleFS partition.
+    lfs_rp2040_params_t params = LFS_RP2040_PRESET_DEFAULT;
+    params.block_count = PARTITION_BLOCKS;
+    lfs_rp2040_init_with(&cfg, &params);
+
+    uint32_t pos;
+    uint32_t region;
+    lfs_rp2040_get_free_region(&pos, &region);
+    region = MIN(region, PARTITION_BLOCKS * FLASH_SECTOR_SIZE);
+
+    if (!ring_log_init(&log, pos, region) || !ring_log_format(&log)) {
+        return false;
+    }
+
+    flash_begin();
+    const uint64_t start_us = nor_flash_time_us();
+
+    for (uint32_t n = 0; n < total / size; n++) {
+        const uint64_t call_us = nor_flash_time_us();
+
+        if (!ring_log_append(&log, record, size)) {
+            return false;
+        }
+        if ((n + 1) % sync_every == 0 && !ring_log_sync(&log)) {
+            return false;
+        }
+
+        track(result, call_us);
+    }
+
+    ring_log_sync(&log);
+    flash_end(result, start_us);
+
+    return true;
+}
+
+static void report(const char* engine, uint32_t sync_every, uint32_t total, const result_t* result) {
+    printf("%-9s %10u %10.1f %8.2f %8u %12u\n", engine, sync_every,
+           total / 1024.0 / (result->elapsed_us / 1e6),
+           (double)result->programmed / total,
+           result->erases, result->max_us);
+}
+
+int main(int argc, char** argv) {
+    const uint32_t size = argc > 1 ? atoi(argv[1]) : 32;
+    const uint32_t total = (argc > 2 ? atoi(argv[2]) : 256) * 1024;
+
+    if (size == 0 || size > RING_LOG_MAX_RECORD) {
+        fprintf(stderr, "record size must be 1 to %u bytes\n", (uint)RING_LOG_MAX_RECORD);
+        return 1;
+    }
+
+    const nor_flash_config_t flash = {
+        .size = FLASH_SIZE,
+        .reserved = 256 * 1024,
+        .latency = NOR_FLASH_LATENCY_W25Q16,
+    };
+
+    if (!nor_flash_open(&flash)) {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        record[i] = i;
+    }
+
+    printf("# %u byte records, %u KB\n", size, total / 1024);
+    printf("%-9s %10s %10s %8s %8s %12s\n", "engine", "sync_every", "KB/s", "write_amp", "erases", "max_call_us");
+
+    const uint32_t sync_intervals[] = { 1, 32, 256 };
+
+    for (uint i = 0; i < sizeof(sync_intervals) / sizeof(sync_intervals[0]); i++) {
+        result_t lfs = {0};
+        result_t log = {0};
+
+        if (!bench_littlefs(&lfs, size, total, sync_intervals[i]) ||
+            !bench_ring_log(&log, size, total, sync_intervals[i])) {
+            fprintf(stderr, "benchmark failed\n");
+            return 1;
+        }
+
+        report("littlefs", sync_intervals[i], total, &lfs);
+        report("ring_log", sync_intervals[i], total, &log);
+    }
+
+    nor_flash_close();
+
+    return 0;
+}
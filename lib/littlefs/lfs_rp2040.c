@@ -1,12 +1,90 @@
 #include "lfs_rp2040.h"
 
+// The host build defines it to the end of its emulated binary.
+#ifndef LFS_RP2040_BINARY_END
 extern char __flash_binary_end;
+#define LFS_RP2040_BINARY_END ((uintptr_t)&__flash_binary_end)
+#endif
+
+typedef struct {
+    uint32_t pos;
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t irq_off_us;    // Measured inside, with the interrupts off.
+} lfs_rp2040_op_t;
+
+static lfs_rp2040_io_stats_t _lfs_rp2040_io;
+static bool _lfs_rp2040_unlocked_flash;
+static uint16_t _lfs_rp2040_erase_counts[LFS_RP2040_MAX_BLOCKS];
 
-static uint storage_get_flash_capacity() {
+static void lfs_rp2040_do_capacity(void* param) {
+    lfs_rp2040_op_t* op = param;
     uint8_t rxbuf[4] = {0};
     uint8_t txbuf[4] = {0x9f};
     flash_do_cmd(txbuf, rxbuf, 4);
-    return 1 << rxbuf[3];
+    op->size = 1 << rxbuf[3];
+}
+
+static void lfs_rp2040_do_program(void* param) {
+    lfs_rp2040_op_t* op = param;
+    const uint32_t start_us = time_us_32();
+    flash_range_program(op->pos, op->data, op->size);
+    op->irq_off_us = time_us_32() - start_us;
+}
+
+static void lfs_rp2040_do_erase(void* param) {
+    lfs_rp2040_op_t* op = param;
+    const uint32_t start_us = time_us_32();
+    flash_range_erase(op->pos, op->size);
+    op->irq_off_us = time_us_32() - start_us;
+}
+
+// Runs a flash operation with the interrupts of this core disabled and the
+// other core parked in RAM by the multicore lockout.
+static int lfs_rp2040_flash_execute(void (*fn)(void*), lfs_rp2040_op_t* op, lfs_rp2040_op_stats_t* stats) {
+    const int rc = flash_safe_execute(fn, op, LFS_RP2040_LOCKOUT_TIMEOUT_MS);
+
+    if (rc == PICO_ERROR_NOT_PERMITTED && _lfs_rp2040_unlocked_flash) {
+        // The other core isn't a lockout victim, the app said it isn't
+        // running or only runs from RAM.
+#ifdef DEBUG
+        printf("[LFS I/O] - NO LOCKOUT VICTIM, OTHER CORE KEEPS RUNNING\n");
+#endif
+        uint32_t ints = save_and_disable_interrupts();
+        fn(op);
+        restore_interrupts(ints);
+    } else if (rc != PICO_OK) {
+#ifdef DEBUG
+        printf("[LFS I/O] - LOCKOUT FAILED: %d\n", rc);
+#endif
+        return LFS_ERR_IO;
+    }
+
+    if (stats) {
+        stats->flash_ops += 1;
+        stats->irq_off_us += op->irq_off_us;
+        if (op->irq_off_us > stats->irq_off_max_us) {
+            stats->irq_off_max_us = op->irq_off_us;
+        }
+    }
+
+    return LFS_ERR_OK;
+}
+
+static int lfs_rp2040_erase_range(lfs_rp2040_op_t* op, lfs_block_t block) {
+    const int err = lfs_rp2040_flash_execute(lfs_rp2040_do_erase, op, &_lfs_rp2040_io.erase);
+    if (err) {
+        return err;
+    }
+
+    const uint32_t count = op->size / FLASH_SECTOR_SIZE;
+    for (lfs_block_t n = block; n < block + count && n < LFS_RP2040_MAX_BLOCKS; n++) {
+        if (_lfs_rp2040_erase_counts[n] < UINT16_MAX) {
+            _lfs_rp2040_erase_counts[n] += 1;
+        }
+    }
+
+    return LFS_ERR_OK;
 }
 
 static struct {
@@ -14,19 +92,122 @@ static struct {
     uint32_t lfs_end_pos;
     uint32_t lfs_start_addr;
     uint32_t lfs_end_addr;
+    uint32_t flash_end_pos;
     uint32_t lfs_block_size;
     uint32_t lfs_read_size;
     uint32_t lfs_write_size;
-} _lfs_rp2040_state;
+    int dma_chan;
+} _lfs_rp2040_state = { .dma_chan = -1 };
+
+// Contiguous programs of the same block are collected here and written
+// with a single flash operation.
+static struct {
+    bool active;
+    lfs_block_t block;
+    lfs_off_t off;
+    lfs_size_t size;
+    uint8_t data[FLASH_SECTOR_SIZE];
+} _lfs_rp2040_pending;
+
+static int lfs_rp2040_flush() {
+    if (!_lfs_rp2040_pending.active) {
+        return LFS_ERR_OK;
+    }
+
+    const uint32_t base_pos = _lfs_rp2040_state.lfs_start_pos;
+    const uint32_t block_offset = _lfs_rp2040_state.lfs_block_size * _lfs_rp2040_pending.block;
+
+    lfs_rp2040_op_t op = {
+        .pos = base_pos + block_offset + _lfs_rp2040_pending.off,
+        .data = _lfs_rp2040_pending.data,
+        .size = _lfs_rp2040_pending.size,
+    };
+
+    _lfs_rp2040_pending.active = false;
 
-void lfs_rp2040_init(struct lfs_config* cfg) {
+    return lfs_rp2040_flash_execute(lfs_rp2040_do_program, &op, &_lfs_rp2040_io.prog);
+}
+
+#ifdef LFS_THREADSAFE
+// Recursive, lfs_rp2040_pool_fill() holds it across lfs_fs_traverse().
+static recursive_mutex_t _lfs_rp2040_mutex;
+
+static int lfs_rp2040_lock(const struct lfs_config *c) {
+    recursive_mutex_enter_blocking(&_lfs_rp2040_mutex);
+    return LFS_ERR_OK;
+}
+
+static int lfs_rp2040_unlock(const struct lfs_config *c) {
+    recursive_mutex_exit(&_lfs_rp2040_mutex);
+    return LFS_ERR_OK;
+}
+#endif
 
-    uint32_t ints = save_and_disable_interrupts();
-    const uintptr_t flash_capacity = storage_get_flash_capacity();
-    restore_interrupts(ints);
+#define POOL_WORDS ((LFS_RP2040_MAX_BLOCKS + 31) / 32)
+#define POOL_GROUP (FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE)
+
+// Blocks erased ahead of time. A block leaves the pool when LittleFS
+// erases it (for free) or programs it.
+static struct {
+    uint32_t erased[POOL_WORDS];
+    uint32_t used[POOL_WORDS];
+    lfs_rp2040_pool_stats_t stats;
+} _lfs_rp2040_pool;
+
+static inline bool pool_test(const uint32_t* map, lfs_block_t block) {
+    return block < LFS_RP2040_MAX_BLOCKS && (map[block / 32] >> (block % 32)) & 1;
+}
+
+static inline void pool_set(uint32_t* map, lfs_block_t block) {
+    if (block < LFS_RP2040_MAX_BLOCKS) {
+        map[block / 32] |= 1u << (block % 32);
+    }
+}
+
+// Removes a block from the pool, returns whether it was erased.
+static inline bool pool_take(lfs_block_t block) {
+    if (!pool_test(_lfs_rp2040_pool.erased, block)) {
+        return false;
+    }
+
+    _lfs_rp2040_pool.erased[block / 32] &= ~(1u << (block % 32));
+    _lfs_rp2040_pool.stats.erased -= 1;
+    return true;
+}
+
+static inline void pool_op_done(uint32_t start_us) {
+    const uint32_t elapsed_us = time_us_32() - start_us;
+    if (elapsed_us > _lfs_rp2040_pool.stats.op_max_us) {
+        _lfs_rp2040_pool.stats.op_max_us = elapsed_us;
+    }
+}
+
+void lfs_rp2040_allow_unlocked_flash(bool allow) {
+    _lfs_rp2040_unlocked_flash = allow;
+}
+
+bool lfs_rp2040_init(struct lfs_config* cfg) {
+    return lfs_rp2040_init_with(cfg, &LFS_RP2040_PRESET_DEFAULT);
+}
+
+bool lfs_rp2040_init_with(struct lfs_config* cfg, const lfs_rp2040_params_t* params) {
+    // LittleFS asserts on these, catch them before they reach lfs_mount().
+    if (params->cache_size == 0 || params->cache_size % FLASH_PAGE_SIZE ||
+        FLASH_SECTOR_SIZE % params->cache_size || params->lookahead_size % 8) {
+#ifdef DEBUG
+        printf("LFS invalid params: cache %u, lookahead %u\n", params->cache_size, params->lookahead_size);
+#endif
+        return false;
+    }
+
+    lfs_rp2040_op_t capacity = {0};
+    if (lfs_rp2040_flash_execute(lfs_rp2040_do_capacity, &capacity, NULL) != LFS_ERR_OK) {
+        return false;
+    }
+    const uint flash_capacity = capacity.size;
 
     const uint32_t bin_start = (uint32_t)XIP_BASE;
-    const uint32_t bin_end = (uint32_t)&__flash_binary_end + 0x40000;
+    const uint32_t bin_end = (uint32_t)LFS_RP2040_BINARY_END + 0x40000;
 
     _lfs_rp2040_state.lfs_read_size = FLASH_PAGE_SIZE;
     _lfs_rp2040_state.lfs_write_size = FLASH_PAGE_SIZE;
@@ -38,10 +219,30 @@ void lfs_rp2040_init(struct lfs_config* cfg) {
 
     _lfs_rp2040_state.lfs_start_pos = _lfs_rp2040_state.lfs_start_addr - bin_start;
     _lfs_rp2040_state.lfs_end_pos = _lfs_rp2040_state.lfs_end_addr - bin_start;
-    
-    const uint lfs_block_count = (_lfs_rp2040_state.lfs_end_addr - 
-                                     _lfs_rp2040_state.lfs_start_addr) / 
-                                         _lfs_rp2040_state.lfs_block_size ;
+    _lfs_rp2040_state.flash_end_pos = _lfs_rp2040_state.lfs_end_pos;
+
+    // Bulk reads fall back to memcpy when no channel is left.
+    if (_lfs_rp2040_state.dma_chan < 0) {
+        _lfs_rp2040_state.dma_chan = dma_claim_unused_channel(false);
+    }
+
+    uint lfs_block_count = (_lfs_rp2040_state.lfs_end_addr - 
+                               _lfs_rp2040_state.lfs_start_addr) / 
+                                   _lfs_rp2040_state.lfs_block_size ;
+
+    // A smaller partition leaves the rest of the flash to the app.
+    if (params->block_count && params->block_count < lfs_block_count) {
+        lfs_block_count = params->block_count;
+        _lfs_rp2040_state.lfs_end_addr = _lfs_rp2040_state.lfs_start_addr +
+                                             lfs_block_count * _lfs_rp2040_state.lfs_block_size;
+        _lfs_rp2040_state.lfs_end_pos = _lfs_rp2040_state.lfs_end_addr - bin_start;
+    }
+
+    // Zero covers the whole partition, one bit per block.
+    uint32_t lookahead_size = params->lookahead_size;
+    if (lookahead_size == 0) {
+        lookahead_size = ((lfs_block_count + 63) / 64) * 8;
+    }
 
 #ifdef DEBUG
     printf("Flash capacity    : 0x%08x\n", flash_capacity);
@@ -59,13 +260,31 @@ void lfs_rp2040_init(struct lfs_config* cfg) {
     cfg->erase = lfs_rp2040_erase;
     cfg->sync  = lfs_rp2040_sync;
 
+#ifdef LFS_THREADSAFE
+    if (!recursive_mutex_is_initialized(&_lfs_rp2040_mutex)) {
+        recursive_mutex_init(&_lfs_rp2040_mutex);
+    }
+
+    cfg->lock = lfs_rp2040_lock;
+    cfg->unlock = lfs_rp2040_unlock;
+#endif
+
     cfg->read_size = _lfs_rp2040_state.lfs_read_size;
     cfg->prog_size = _lfs_rp2040_state.lfs_write_size;
     cfg->block_size = _lfs_rp2040_state.lfs_block_size;
     cfg->block_count = lfs_block_count;
-    cfg->cache_size = _lfs_rp2040_state.lfs_write_size;
-    cfg->lookahead_size = 16;
-    cfg->block_cycles = 500;
+    // The pool is only valid for the partition it was filled for.
+    memset(&_lfs_rp2040_pool, 0, sizeof(_lfs_rp2040_pool));
+    _lfs_rp2040_pending.active = false;
+
+    memset(&_lfs_rp2040_io, 0, sizeof(_lfs_rp2040_io));
+    memset(_lfs_rp2040_erase_counts, 0, sizeof(_lfs_rp2040_erase_counts));
+
+    cfg->cache_size = params->cache_size;
+    cfg->lookahead_size = lookahead_size;
+    cfg->block_cycles = params->block_cycles;
+
+    return true;
 }
 
 int lfs_rp2040_read(const struct lfs_config *c, lfs_block_t block,
@@ -74,12 +293,50 @@ int lfs_rp2040_read(const struct lfs_config *c, lfs_block_t block,
     printf("[LFS I/O] - READ - B: 0x%08x | O: 0x%08x | S: 0x%08x\n", block, off, size);
 #endif
 
-    const uint32_t base_addr = _lfs_rp2040_state.lfs_start_addr;
+    _lfs_rp2040_io.read.calls += 1;
+    _lfs_rp2040_io.read.bytes += size;
+
+    // LittleFS reads back what it programs, it must reach the flash first.
+    if (_lfs_rp2040_pending.active && _lfs_rp2040_pending.block == block &&
+        off < _lfs_rp2040_pending.off + _lfs_rp2040_pending.size &&
+        _lfs_rp2040_pending.off < off + size) {
+        const int err = lfs_rp2040_flush();
+        if (err) {
+            return err;
+        }
+    }
+
+    const uint32_t base_pos = _lfs_rp2040_state.lfs_start_pos;
     const uint32_t block_offset = _lfs_rp2040_state.lfs_block_size * block;
+    const uint32_t pos = base_pos + block_offset + off;
+
+    // Reading through XIP is safe with interrupts enabled, the flash is only
+    // unavailable inside prog and erase, which don't return until it's back.
+    // The other core is locked out while they run.
+    if (size < LFS_RP2040_BULK_READ_SIZE) {
+        memcpy(buffer, (void*)(XIP_BASE + pos), size);
+        return LFS_ERR_OK;
+    }
 
-    uint32_t ints = save_and_disable_interrupts();
-    memcpy(buffer, (void*)(base_addr + block_offset + off), size);
-    restore_interrupts(ints);
+    // Bulk reads bypass the XIP cache, so they don't evict the running code.
+    const int chan = _lfs_rp2040_state.dma_chan;
+
+    if (chan >= 0 && ((pos | (uintptr_t)buffer | size) & 3) == 0) {
+        dma_channel_config cfg = dma_channel_get_default_config(chan);
+        channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+        channel_config_set_read_increment(&cfg, true);
+        channel_config_set_write_increment(&cfg, true);
+
+        dma_channel_configure(chan, &cfg,
+            buffer,                                         // dst
+            (const void*)(XIP_NOCACHE_NOALLOC_BASE + pos),  // src
+            size / 4,                                       // transfer count
+            true                                            // start now
+        );
+        dma_channel_wait_for_finish_blocking(chan);
+    } else {
+        memcpy(buffer, (void*)(XIP_NOALLOC_BASE + pos), size);
+    }
 
     return LFS_ERR_OK;
 }
@@ -90,12 +347,35 @@ int lfs_rp2040_prog(const struct lfs_config *c, lfs_block_t block,
     printf("[LFS I/O] - PROG - B: 0x%08x | O: 0x%08x | S: 0x%08x\n", block, off, size);
 #endif  
 
-    const uint32_t base_pos = _lfs_rp2040_state.lfs_start_pos;
-    const uint32_t block_offset = _lfs_rp2040_state.lfs_block_size * block;
+    const uint32_t start_us = time_us_32();
 
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_program(base_pos + block_offset + off, buffer, size);
-    restore_interrupts(ints);
+    _lfs_rp2040_io.prog.calls += 1;
+    _lfs_rp2040_io.prog.bytes += size;
+
+    pool_take(block);
+
+    const bool contiguous = _lfs_rp2040_pending.active &&
+                            _lfs_rp2040_pending.block == block &&
+                            _lfs_rp2040_pending.off + _lfs_rp2040_pending.size == off;
+
+    if (!contiguous) {
+        const int err = lfs_rp2040_flush();
+        if (err) {
+            pool_op_done(start_us);
+            return err;
+        }
+
+        _lfs_rp2040_pending.active = true;
+        _lfs_rp2040_pending.block = block;
+        _lfs_rp2040_pending.off = off;
+        _lfs_rp2040_pending.size = 0;
+    }
+
+    // The buffer only holds one block, programs never cross a block.
+    memcpy(_lfs_rp2040_pending.data + _lfs_rp2040_pending.size, buffer, size);
+    _lfs_rp2040_pending.size += size;
+
+    pool_op_done(start_us);
 
     return LFS_ERR_OK;
 }
@@ -105,20 +385,231 @@ int lfs_rp2040_erase(const struct lfs_config *c, lfs_block_t block) {
     printf("[LFS I/O] - ERASE - B: 0x%08x\n", block);
 #endif
 
+    const uint32_t start_us = time_us_32();
+
+    _lfs_rp2040_io.erase.calls += 1;
+    _lfs_rp2040_io.erase.bytes += _lfs_rp2040_state.lfs_block_size;
+
+    int err = lfs_rp2040_flush();
+    if (err) {
+        pool_op_done(start_us);
+        return err;
+    }
+
+    if (pool_take(block)) {
+        _lfs_rp2040_pool.stats.hits += 1;
+        pool_op_done(start_us);
+        return LFS_ERR_OK;
+    }
+
+    _lfs_rp2040_pool.stats.misses += 1;
+
     const uint32_t block_size = _lfs_rp2040_state.lfs_block_size;
     const uint32_t base_pos = _lfs_rp2040_state.lfs_start_pos;
     const uint32_t block_offset = _lfs_rp2040_state.lfs_block_size * block;
 
-    uint32_t ints = save_and_disable_interrupts();
-    flash_range_erase(base_pos + block_offset, block_size);
-    restore_interrupts(ints);
+    lfs_rp2040_op_t op = {
+        .pos = base_pos + block_offset,
+        .size = block_size,
+    };
 
-    return LFS_ERR_OK;
+    err = lfs_rp2040_erase_range(&op, block);
+    pool_op_done(start_us);
+
+    return err;
 }
 
 int lfs_rp2040_sync(const struct lfs_config *c) {
 #ifdef DEBUG
     printf("[LFS I/O] - SYNC\n");
 #endif
+
+    const uint32_t start_us = time_us_32();
+
+    _lfs_rp2040_io.syncs += 1;
+
+    const int err = lfs_rp2040_flush();
+    pool_op_done(start_us);
+
+    return err;
+}
+
+static int lfs_rp2040_pool_mark(void* data, lfs_block_t block) {
+    pool_set(_lfs_rp2040_pool.used, block);
+    return LFS_ERR_OK;
+}
+
+static inline bool pool_free(lfs_block_t block) {
+    return !pool_test(_lfs_rp2040_pool.used, block) && !pool_test(_lfs_rp2040_pool.erased, block);
+}
+
+int lfs_rp2040_pool_fill(lfs_t* lfs, uint32_t max_blocks) {
+#ifdef LFS_THREADSAFE
+    recursive_mutex_enter_blocking(&_lfs_rp2040_mutex);
+#endif
+
+    // A block that LittleFS doesn't reference holds no data, it can be
+    // erased at any time before LittleFS allocates it.
+    memset(_lfs_rp2040_pool.used, 0, sizeof(_lfs_rp2040_pool.used));
+    int err = lfs_fs_traverse(lfs, lfs_rp2040_pool_mark, NULL);
+
+    const uint32_t block_size = _lfs_rp2040_state.lfs_block_size;
+    const uint32_t base_pos = _lfs_rp2040_state.lfs_start_pos;
+    uint32_t block_count = lfs->cfg->block_count;
+    if (block_count > LFS_RP2040_MAX_BLOCKS) {
+        block_count = LFS_RP2040_MAX_BLOCKS;
+    }
+
+    uint32_t erased = 0;
+
+    for (lfs_block_t block = 0; !err && block < block_count && erased < max_blocks; block++) {
+        if (!pool_free(block)) {
+            continue;
+        }
+
+        const uint32_t pos = base_pos + block * block_size;
+        lfs_rp2040_op_t op = { .pos = pos, .size = block_size };
+
+        // A whole free 64 KB flash block is erased by one command, it takes
+        // about as long as three sector erases.
+        if (pos % FLASH_BLOCK_SIZE == 0 && block + POOL_GROUP <= block_count &&
+            erased + POOL_GROUP <= max_blocks) {
+            lfs_block_t n = 1;
+            while (n < POOL_GROUP && pool_free(block + n)) {
+                n++;
+            }
+
+            if (n == POOL_GROUP) {
+                op.size = FLASH_BLOCK_SIZE;
+            }
+        }
+
+        err = lfs_rp2040_erase_range(&op, block);
+        if (err) {
+            break;
+        }
+
+        const uint32_t count = op.size / block_size;
+        for (lfs_block_t n = 0; n < count; n++) {
+            pool_set(_lfs_rp2040_pool.erased, block + n);
+        }
+
+        if (count > 1) {
+            _lfs_rp2040_pool.stats.fill_64k += 1;
+        } else {
+            _lfs_rp2040_pool.stats.fill_4k += 1;
+        }
+
+        _lfs_rp2040_pool.stats.erased += count;
+        erased += count;
+        block += count - 1;
+    }
+
+#ifdef LFS_THREADSAFE
+    recursive_mutex_exit(&_lfs_rp2040_mutex);
+#endif
+
+    return err ? err : (int)erased;
+}
+
+void lfs_rp2040_pool_get_stats(lfs_rp2040_pool_stats_t* stats) {
+    *stats = _lfs_rp2040_pool.stats;
+}
+
+void lfs_rp2040_pool_reset_stats() {
+    const uint32_t erased = _lfs_rp2040_pool.stats.erased;
+
+    memset(&_lfs_rp2040_pool.stats, 0, sizeof(_lfs_rp2040_pool.stats));
+    _lfs_rp2040_pool.stats.erased = erased;
+}
+
+void lfs_rp2040_get_io_stats(lfs_rp2040_io_stats_t* stats) {
+    *stats = _lfs_rp2040_io;
+}
+
+void lfs_rp2040_reset_io_stats() {
+    memset(&_lfs_rp2040_io, 0, sizeof(_lfs_rp2040_io));
+}
+
+uint32_t lfs_rp2040_get_erase_count(lfs_block_t block) {
+    return block < LFS_RP2040_MAX_BLOCKS ? _lfs_rp2040_erase_counts[block] : 0;
+}
+
+void lfs_rp2040_get_free_region(uint32_t* pos, uint32_t* size) {
+    *pos = _lfs_rp2040_state.lfs_end_pos;
+    *size = _lfs_rp2040_state.flash_end_pos - _lfs_rp2040_state.lfs_end_pos;
+}
+
+// Offset of `pos` in its block of a CTZ skip-list and the index of that
+// block, like lfs_ctz_index() of LittleFS. Block i starts with ctz(i) + 1
+// pointers to earlier blocks, block 0 with none.
+static lfs_off_t lfs_rp2040_ctz_index(lfs_size_t block_size, lfs_off_t* off) {
+    const lfs_off_t size = *off;
+    const lfs_off_t b = block_size - 2 * 4;
+    lfs_off_t i = size / b;
+
+    if (i == 0) {
+        return 0;
+    }
+
+    i = (size - 4 * (lfs_popc(i - 1) + 2)) / b;
+    *off = size - b * i - 4 * lfs_popc(i);
+
+    return i;
+}
+
+int lfs_rp2040_file_span(lfs_t* lfs, lfs_file_t* file, lfs_off_t pos, const uint8_t** data, lfs_size_t* size) {
+    // Inline files live in metadata, unsynced data in the file cache.
+    if (file->flags & (LFS_F_INLINE | LFS_F_DIRTY | LFS_F_WRITING)) {
+        return LFS_ERR_INVAL;
+    }
+
+    if (pos >= file->ctz.size) {
+        *size = 0;
+        return LFS_ERR_OK;
+    }
+
+#ifdef LFS_THREADSAFE
+    recursive_mutex_enter_blocking(&_lfs_rp2040_mutex);
+#endif
+
+    // The skip-list is read through XIP, it must be in the flash.
+    int err = lfs_rp2040_flush();
+
+    const lfs_size_t block_size = lfs->cfg->block_size;
+    const uint8_t* base = (const uint8_t*)(XIP_NOALLOC_BASE + _lfs_rp2040_state.lfs_start_pos);
+
+    lfs_off_t last_off = file->ctz.size - 1;
+    lfs_off_t current = lfs_rp2040_ctz_index(block_size, &last_off);
+    lfs_off_t off = pos;
+    const lfs_off_t target = lfs_rp2040_ctz_index(block_size, &off);
+    lfs_block_t block = file->ctz.head;
+
+    // Walks back from the last block, the same jumps as lfs_ctz_find().
+    while (!err && current > target) {
+        const lfs_size_t skip = lfs_min(lfs_npw2(current - target + 1) - 1, lfs_ctz(current));
+
+        if (block >= lfs->cfg->block_count) {
+            err = LFS_ERR_CORRUPT;
+            break;
+        }
+
+        uint32_t next;
+        memcpy(&next, base + block * block_size + 4 * skip, sizeof(next));
+        block = lfs_fromle32(next);
+        current -= 1 << skip;
+    }
+
+#ifdef LFS_THREADSAFE
+    recursive_mutex_exit(&_lfs_rp2040_mutex);
+#endif
+
+    if (err) {
+        return err;
+    }
+
+    *data = base + block * block_size + off;
+    *size = lfs_min(block_size - off, file->ctz.size - pos);
+
     return LFS_ERR_OK;
 }
@@ -7,12 +7,86 @@
 #include <lfs.h>
 #include <lfs_util.h>
 
+#include "hardware/dma.h"
 #include "hardware/flash.h"
 #include "hardware/sync.h"
+#include "pico/flash.h"
+#include "pico/mutex.h"
 #include "pico/stdio.h"
 #include "pico/stdlib.h"
 
-void lfs_rp2040_init(struct lfs_config* cfg);
+// Reads of at least this many bytes skip the XIP cache.
+#ifndef LFS_RP2040_BULK_READ_SIZE
+#define LFS_RP2040_BULK_READ_SIZE 1024
+#endif
+
+// Time to wait for the other core to enter the multicore lockout.
+#ifndef LFS_RP2040_LOCKOUT_TIMEOUT_MS
+#define LFS_RP2040_LOCKOUT_TIMEOUT_MS 100
+#endif
+
+// Blocks tracked by the pre-erased pool and the erase counters, the whole
+// flash of the board.
+#ifndef LFS_RP2040_MAX_BLOCKS
+#define LFS_RP2040_MAX_BLOCKS (PICO_FLASH_SIZE_BYTES / FLASH_SECTOR_SIZE)
+#endif
+
+typedef struct {
+    uint32_t calls;             // Calls from LittleFS.
+    uint64_t bytes;             // Bytes passed by LittleFS.
+    uint32_t flash_ops;         // Flash operations, after merging programs and the erase pool.
+    uint64_t irq_off_us;        // Total time of the flash operations, interrupts off.
+    uint32_t irq_off_max_us;    // Longest flash operation.
+} lfs_rp2040_op_stats_t;
+
+typedef struct {
+    lfs_rp2040_op_stats_t read;     // Reads never disable the interrupts.
+    lfs_rp2040_op_stats_t prog;
+    lfs_rp2040_op_stats_t erase;    // Includes the erases of lfs_rp2040_pool_fill().
+    uint32_t syncs;
+} lfs_rp2040_io_stats_t;
+
+typedef struct {
+    uint32_t erased;            // Blocks in the pool.
+    uint32_t hits;              // Erases served from the pool, no flash access.
+    uint32_t misses;            // Erases done in the call, LittleFS waits for them.
+    uint32_t fill_4k;           // Sector erases done by lfs_rp2040_pool_fill().
+    uint32_t fill_64k;          // 64 KB block erases done by lfs_rp2040_pool_fill().
+    uint32_t op_max_us;         // Slowest prog, erase or sync: the worst stall of a write.
+} lfs_rp2040_pool_stats_t;
+
+typedef struct {
+    uint32_t cache_size;        // Multiple of 256 bytes that divides the 4 KB block.
+    uint32_t lookahead_size;    // Multiple of 8 bytes, one bit per block. 0 covers the whole partition.
+    int32_t block_cycles;       // Erases before a metadata block is moved, -1 disables wear leveling.
+    uint32_t block_count;       // Partition size in 4 KB blocks, 0 uses the rest of the flash.
+} lfs_rp2040_params_t;
+
+// The same layout as before the parameters existed: one page of cache and a
+// lookahead scanning 128 blocks at a time. Lowest RAM use.
+#define LFS_RP2040_PRESET_SMALL ((lfs_rp2040_params_t){ \
+    .cache_size = 256, .lookahead_size = 16, .block_cycles = 500 })
+
+// Four pages of cache and a lookahead covering 512 blocks (2 MB).
+#define LFS_RP2040_PRESET_DEFAULT ((lfs_rp2040_params_t){ \
+    .cache_size = 1024, .lookahead_size = 64, .block_cycles = 500 })
+
+// A block of cache, so sequential writes program whole blocks, and a
+// lookahead covering the whole partition. About 8 KB of RAM per open file.
+#define LFS_RP2040_PRESET_FAST ((lfs_rp2040_params_t){ \
+    .cache_size = 4096, .lookahead_size = 0, .block_cycles = 500 })
+
+// Lets prog and erase run with only the interrupts of the calling core
+// disabled when the other core isn't a lockout victim. Only for apps where
+// the other core isn't started or runs from RAM; without it they return
+// LFS_ERR_IO. Call it before lfs_rp2040_init(), which reads the flash ID.
+void lfs_rp2040_allow_unlocked_flash(bool allow);
+
+// Both return false when the flash can't be reached (no lockout victim or a
+// lockout timeout) or the params are invalid; cfg isn't usable then.
+bool lfs_rp2040_init(struct lfs_config* cfg);
+
+bool lfs_rp2040_init_with(struct lfs_config* cfg, const lfs_rp2040_params_t* params);
 
 int lfs_rp2040_read(const struct lfs_config *c, lfs_block_t block,
                     lfs_off_t off, void *buffer, lfs_size_t size);
@@ -24,4 +98,31 @@ int lfs_rp2040_erase(const struct lfs_config *c, lfs_block_t block);
 
 int lfs_rp2040_sync(const struct lfs_config *c);
 
+// Erases up to max_blocks blocks that LittleFS doesn't use, so their next
+// erase returns at once. Call it when idle, with the filesystem mounted.
+// Returns the number of blocks erased or a negative LittleFS error.
+int lfs_rp2040_pool_fill(lfs_t* lfs, uint32_t max_blocks);
+
+void lfs_rp2040_pool_get_stats(lfs_rp2040_pool_stats_t* stats);
+
+void lfs_rp2040_pool_reset_stats();
+
+void lfs_rp2040_get_io_stats(lfs_rp2040_io_stats_t* stats);
+
+void lfs_rp2040_reset_io_stats();
+
+// The flash left after the partition when `block_count` limits it, as a
+// flash offset and size, for storage that skips the filesystem.
+void lfs_rp2040_get_free_region(uint32_t* pos, uint32_t* size);
+
+// Maps the file data at `pos` without copying it: `data` points into the
+// XIP window (no-allocate alias) and `size` is the length of the run that
+// is contiguous in the flash, up to the end of its block or of the file.
+// Returns LFS_ERR_INVAL for a file that is inline or has unsynced writes,
+// read those with lfs_file_read(). The span is valid until the file changes.
+int lfs_rp2040_file_span(lfs_t* lfs, lfs_file_t* file, lfs_off_t pos, const uint8_t** data, lfs_size_t* size);
+
+// Erases of a block since lfs_rp2040_init(), saturates at 65535.
+uint32_t lfs_rp2040_get_erase_count(lfs_block_t block);
+
 #endif
@@ -0,0 +1,409 @@
+#include "ring_log.h"
+
+typedef struct {
+    uint32_t pos;
+    const uint8_t* data;
+    uint32_t size;
+    uint32_t irq_off_us;
+} ring_log_op_t;
+
+static bool ring_log_unlocked_flash;
+
+static void ring_log_do_program(void* param) {
+    ring_log_op_t* op = param;
+    const uint32_t start_us = time_us_32();
+    flash_range_program(op->pos, op->data, op->size);
+    op->irq_off_us = time_us_32() - start_us;
+}
+
+static void ring_log_do_erase(void* param) {
+    ring_log_op_t* op = param;
+    const uint32_t start_us = time_us_32();
+    flash_range_erase(op->pos, op->size);
+    op->irq_off_us = time_us_32() - start_us;
+}
+
+// Same rules as the LittleFS port: the other core is locked out, or the
+// app allowed it to keep running from RAM.
+static bool ring_log_execute(ring_log_t* log, void (*fn)(void*), ring_log_op_t* op) {
+    const int rc = flash_safe_execute(fn, op, RING_LOG_LOCKOUT_TIMEOUT_MS);
+
+    if (rc == PICO_ERROR_NOT_PERMITTED && ring_log_unlocked_flash) {
+#ifdef DEBUG
+        printf("[RING LOG] - NO LOCKOUT VICTIM, OTHER CORE KEEPS RUNNING\n");
+#endif
+        uint32_t ints = save_and_disable_interrupts();
+        fn(op);
+        restore_interrupts(ints);
+    } else if (rc != PICO_OK) {
+#ifdef DEBUG
+        printf("[RING LOG] - LOCKOUT FAILED: %d\n", rc);
+#endif
+        return false;
+    }
+
+    if (op->irq_off_us > log->stats.irq_off_max_us) {
+        log->stats.irq_off_max_us = op->irq_off_us;
+    }
+
+    return true;
+}
+
+static inline uint32_t sector_pos(const ring_log_t* log, uint32_t sector) {
+    return log->pos + sector * RING_LOG_SECTOR_SIZE;
+}
+
+static inline const uint8_t* sector_xip(const ring_log_t* log, uint32_t sector) {
+    return (const uint8_t*)(XIP_BASE + sector_pos(log, sector));
+}
+
+static bool sector_valid(const ring_log_t* log, uint32_t sector, uint32_t* seq) {
+    ring_log_header_t header;
+    memcpy(&header, sector_xip(log, sector), sizeof(header));
+
+    if (header.magic != RING_LOG_MAGIC || header.seq_inv != ~header.seq) {
+        return false;
+    }
+
+    *seq = header.seq;
+    return true;
+}
+
+static uint16_t fletcher16(const uint8_t* data, uint32_t size) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    for (uint32_t i = 0; i < size; i++) {
+        a = (a + data[i]) % 255;
+        b = (b + a) % 255;
+    }
+
+    return (b << 8) | a;
+}
+
+// Programs the page being filled, whole or in part. Bytes past the write
+// offset are 0xFF and stay erased, so the page can be programmed again.
+static bool ring_log_program_page(ring_log_t* log) {
+    const uint32_t page_start = (log->offset - 1) & ~(FLASH_PAGE_SIZE - 1);
+
+    ring_log_op_t op = {
+        .pos = sector_pos(log, log->head) + page_start,
+        .data = log->page,
+        .size = FLASH_PAGE_SIZE,
+    };
+
+    if (!ring_log_execute(log, ring_log_do_program, &op)) {
+        return false;
+    }
+
+    log->synced = log->offset;
+    log->stats.programs += 1;
+    log->stats.programmed += FLASH_PAGE_SIZE;
+
+    return true;
+}
+
+// Copies bytes into the page buffer, programming each page that fills up.
+static bool ring_log_put(ring_log_t* log, const void* data, uint32_t size) {
+    const uint8_t* src = data;
+
+    while (size) {
+        const uint32_t in_page = log->offset % FLASH_PAGE_SIZE;
+        const uint32_t n = MIN(size, FLASH_PAGE_SIZE - in_page);
+
+        memcpy(log->page + in_page, src, n);
+        log->offset += n;
+        src += n;
+        size -= n;
+
+        if (log->offset % FLASH_PAGE_SIZE == 0) {
+            if (!ring_log_program_page(log)) {
+                return false;
+            }
+            memset(log->page, 0xFF, sizeof(log->page));
+        }
+    }
+
+    return true;
+}
+
+// Erases the next sector, the oldest one once the ring is full.
+static bool ring_log_open_sector(ring_log_t* log) {
+    const uint32_t next = (log->head + 1) % log->sectors;
+
+    ring_log_op_t op = {
+        .pos = sector_pos(log, next),
+        .size = RING_LOG_SECTOR_SIZE,
+    };
+
+    if (!ring_log_execute(log, ring_log_do_erase, &op)) {
+        return false;
+    }
+
+    log->stats.erases += 1;
+    log->head = next;
+    log->seq += 1;
+    log->offset = 0;
+    log->synced = 0;
+    log->empty = false;
+    memset(log->page, 0xFF, sizeof(log->page));
+
+    const ring_log_header_t header = {
+        .magic = RING_LOG_MAGIC,
+        .seq = log->seq,
+        .seq_inv = ~log->seq,
+        .reserved = 0xFFFFFFFF,
+    };
+
+    return ring_log_put(log, &header, sizeof(header));
+}
+
+static void ring_log_reset(ring_log_t* log) {
+    // The first append opens sector 0 with sequence 0.
+    log->head = log->sectors - 1;
+    log->seq = UINT32_MAX;
+    log->offset = RING_LOG_SECTOR_SIZE;
+    log->synced = RING_LOG_SECTOR_SIZE;
+    log->empty = true;
+}
+
+// Finds the end of the records of the head sector.
+static void ring_log_recover_head(ring_log_t* log) {
+    const uint8_t* sector = sector_xip(log, log->head);
+    uint32_t offset = sizeof(ring_log_header_t);
+
+    while (offset + sizeof(ring_log_record_t) <= RING_LOG_SECTOR_SIZE) {
+        ring_log_record_t record;
+        memcpy(&record, sector + offset, sizeof(record));
+
+        if (record.size == RING_LOG_ERASED) {
+            break;
+        }
+
+        const uint32_t end = offset + sizeof(record) + record.size;
+
+        if (record.size == 0 || end > RING_LOG_SECTOR_SIZE ||
+            fletcher16(sector + offset + sizeof(record), record.size) != record.check) {
+            // A program was cut here, the rest of the sector can't be
+            // programmed safely. Appends continue in the next sector.
+            log->stats.torn += 1;
+            offset = RING_LOG_SECTOR_SIZE;
+            break;
+        }
+
+        log->stats.recovered += 1;
+        offset = end;
+    }
+
+    log->offset = offset;
+    log->synced = offset;
+
+    const uint32_t in_page = offset % FLASH_PAGE_SIZE;
+    memset(log->page, 0xFF, sizeof(log->page));
+    memcpy(log->page, sector + offset - in_page, in_page);
+}
+
+void ring_log_allow_unlocked_flash(bool allow) {
+    ring_log_unlocked_flash = allow;
+}
+
+bool ring_log_init(ring_log_t* log, uint32_t pos, uint32_t size) {
+    memset(log, 0, sizeof(*log));
+
+    if (pos % RING_LOG_SECTOR_SIZE || size / RING_LOG_SECTOR_SIZE < 2) {
+        return false;
+    }
+
+    log->pos = pos;
+    log->sectors = size / RING_LOG_SECTOR_SIZE;
+
+    // Sectors are written in order and their sequence numbers grow by one,
+    // so the sectors up to the head are the ones whose number is the one of
+    // sector 0 plus their index. That is a prefix, its end is the head.
+    uint32_t seq0;
+    uint32_t seq;
+
+    if (sector_valid(log, 0, &seq0)) {
+        uint32_t lo = 0;
+        uint32_t hi = log->sectors;
+
+        while (hi - lo > 1) {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            if (sector_valid(log, mid, &seq) && seq == seq0 + mid) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+
+        log->head = lo;
+        log->seq = seq0 + lo;
+    } else if (sector_valid(log, log->sectors - 1, &seq)) {
+        // Cut while erasing sector 0 to wrap around.
+        log->head = log->sectors - 1;
+        log->seq = seq;
+    } else {
+        ring_log_reset(log);
+        return true;
+    }
+
+    ring_log_recover_head(log);
+
+#ifdef DEBUG
+    printf("[RING LOG] - HEAD: %u | SEQ: %u | OFFSET: %u\n", log->head, log->seq, log->offset);
+#endif
+
+    return true;
+}
+
+bool ring_log_format(ring_log_t* log) {
+    // One sector at a time, interrupts are only off for one erase.
+    for (uint32_t sector = 0; sector < log->sectors; sector++) {
+        ring_log_op_t op = {
+            .pos = sector_pos(log, sector),
+            .size = RING_LOG_SECTOR_SIZE,
+        };
+
+        if (!ring_log_execute(log, ring_log_do_erase, &op)) {
+            return false;
+        }
+
+        log->stats.erases += 1;
+    }
+
+    ring_log_reset(log);
+
+    return true;
+}
+
+bool ring_log_append(ring_log_t* log, const void* data, uint16_t size) {
+    if (size == 0 || size > RING_LOG_MAX_RECORD) {
+        return false;
+    }
+
+    const ring_log_record_t record = {
+        .size = size,
+        .check = fletcher16(data, size),
+    };
+
+    if (log->offset + sizeof(record) + size > RING_LOG_SECTOR_SIZE) {
+        // The end of the sector stays erased, readers skip it.
+        if (log->offset > log->synced && !ring_log_program_page(log)) {
+            return false;
+        }
+
+        if (!ring_log_open_sector(log)) {
+            return false;
+        }
+    }
+
+    if (!ring_log_put(log, &record, sizeof(record)) || !ring_log_put(log, data, size)) {
+        return false;
+    }
+
+    log->stats.appended += size;
+    log->stats.records += 1;
+
+    return true;
+}
+
+bool ring_log_sync(ring_log_t* log) {
+    if (log->offset <= log->synced || log->offset % FLASH_PAGE_SIZE == 0) {
+        return true;
+    }
+
+    return ring_log_program_page(log);
+}
+
+static bool ring_log_enter(const ring_log_t* log, ring_log_cursor_t* cursor, uint32_t sector, uint32_t seq) {
+    uint32_t found;
+
+    if (!sector_valid(log, sector, &found) || found != seq) {
+        return false;
+    }
+
+    cursor->sector = sector;
+    cursor->seq = seq;
+    cursor->offset = sizeof(ring_log_header_t);
+
+    return true;
+}
+
+bool ring_log_first(const ring_log_t* log, ring_log_cursor_t* cursor) {
+    if (log->empty) {
+        return false;
+    }
+
+    // The oldest sector may be missing or erased, the first one holding
+    // the expected sequence number is the start.
+    for (uint32_t back = log->sectors - 1; back > 0; back--) {
+        const uint32_t sector = (log->head + log->sectors - back) % log->sectors;
+        if (ring_log_enter(log, cursor, sector, log->seq - back)) {
+            return true;
+        }
+    }
+
+    return ring_log_enter(log, cursor, log->head, log->seq);
+}
+
+bool ring_log_next(const ring_log_t* log, ring_log_cursor_t* cursor, const uint8_t** data, uint16_t* size) {
+    while (true) {
+        const bool head = cursor->sector == log->head && cursor->seq == log->seq;
+        const uint32_t limit = head ? log->synced : RING_LOG_SECTOR_SIZE;
+
+        if (cursor->offset + sizeof(ring_log_record_t) <= limit) {
+            const uint8_t* sector = sector_xip(log, cursor->sector);
+
+            ring_log_record_t record;
+            memcpy(&record, sector + cursor->offset, sizeof(record));
+
+            const uint32_t end = cursor->offset + sizeof(record) + record.size;
+
+            if (record.size != RING_LOG_ERASED && record.size != 0 && end <= limit) {
+                const uint8_t* payload = sector + cursor->offset + sizeof(record);
+
+                if (fletcher16(payload, record.size) == record.check) {
+                    *data = payload;
+                    *size = record.size;
+                    cursor->offset = end;
+                    return true;
+                }
+            }
+        }
+
+        // End of the sector, or a record cut by a power loss.
+        if (head) {
+            return false;
+        }
+
+        if (!ring_log_enter(log, cursor, (cursor->sector + 1) % log->sectors, cursor->seq + 1)) {
+            return false;
+        }
+    }
+}
+
+bool ring_log_next_span(const ring_log_t* log, ring_log_cursor_t* cursor, const uint8_t** data, uint32_t* size) {
+    while (true) {
+        const bool head = cursor->sector == log->head && cursor->seq == log->seq;
+        const uint32_t limit = head ? log->synced : RING_LOG_SECTOR_SIZE;
+
+        if (cursor->offset < limit) {
+            *data = sector_xip(log, cursor->sector) + cursor->offset;
+            *size = limit - cursor->offset;
+            cursor->offset = limit;
+            return true;
+        }
+
+        if (head) {
+            return false;
+        }
+
+        if (!ring_log_enter(log, cursor, (cursor->sector + 1) % log->sectors, cursor->seq + 1)) {
+            return false;
+        }
+    }
+}
+
+void ring_log_get_stats(const ring_log_t* log, ring_log_stats_t* stats) {
+    *stats = log->stats;
+}
@@ -0,0 +1,103 @@
+#ifndef RING_LOG_H
+#define RING_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "pico/flash.h"
+#include "pico/stdlib.h"
+
+// Append-only log of records in a ring of raw flash sectors, without a
+// filesystem. Each sector starts with a header holding a sequence number
+// that grows by one per sector, so the write head is found by a binary
+// search at boot. When the ring is full the oldest sector is erased.
+//
+// Sector: [ring_log_header_t][record][record]...[0xFF padding]
+// Record: [ring_log_record_t][payload]
+
+#define RING_LOG_MAGIC 0x474F4C52   // "RLOG"
+#define RING_LOG_SECTOR_SIZE FLASH_SECTOR_SIZE
+#define RING_LOG_ERASED 0xFFFF
+
+#ifndef RING_LOG_LOCKOUT_TIMEOUT_MS
+#define RING_LOG_LOCKOUT_TIMEOUT_MS 100
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t seq_inv;           // ~seq, rejects a header cut by a power loss.
+    uint32_t reserved;
+} ring_log_header_t;
+
+typedef struct {
+    uint16_t size;              // RING_LOG_ERASED past the last record of a sector.
+    uint16_t check;             // Fletcher-16 of the payload.
+} ring_log_record_t;
+
+#define RING_LOG_MAX_RECORD (RING_LOG_SECTOR_SIZE - sizeof(ring_log_header_t) - sizeof(ring_log_record_t))
+
+typedef struct {
+    uint32_t appended;          // Payload bytes appended.
+    uint32_t records;
+    uint32_t programmed;        // Bytes programmed, whole pages.
+    uint32_t programs;
+    uint32_t erases;
+    uint32_t irq_off_max_us;    // Longest flash operation.
+    uint32_t recovered;         // Records of the head sector found at init.
+    uint32_t torn;              // Records dropped at init, cut by a power loss.
+} ring_log_stats_t;
+
+typedef struct {
+    uint32_t pos;               // Flash offset of the region, sector aligned.
+    uint32_t sectors;
+    uint32_t head;              // Sector being written.
+    uint32_t seq;               // Sequence number of the head sector.
+    uint32_t offset;            // Write offset in the head sector.
+    uint32_t synced;            // Bytes of the head sector in the flash.
+    bool empty;
+    uint8_t page[FLASH_PAGE_SIZE];
+    ring_log_stats_t stats;
+} ring_log_t;
+
+typedef struct {
+    uint32_t sector;
+    uint32_t seq;
+    uint32_t offset;
+} ring_log_cursor_t;
+
+// Same as lfs_rp2040_allow_unlocked_flash(): without it, programs and erases
+// fail when the other core isn't a lockout victim.
+void ring_log_allow_unlocked_flash(bool allow);
+
+// Opens the log stored in `size` bytes at flash offset `pos` and finds the
+// write head. A region without a valid sector is an empty log.
+bool ring_log_init(ring_log_t* log, uint32_t pos, uint32_t size);
+
+// Erases the whole region.
+bool ring_log_format(ring_log_t* log);
+
+// Appends a record of up to RING_LOG_MAX_RECORD bytes. Whole pages are
+// programmed as they fill up, the rest waits for ring_log_sync().
+bool ring_log_append(ring_log_t* log, const void* data, uint16_t size);
+
+// Programs the partial page, the records appended so far survive a reset.
+bool ring_log_sync(ring_log_t* log);
+
+// Iterates the synced records from the oldest. The payload points into
+// the XIP window, it is valid until the sector is overwritten.
+bool ring_log_first(const ring_log_t* log, ring_log_cursor_t* cursor);
+
+bool ring_log_next(const ring_log_t* log, ring_log_cursor_t* cursor, const uint8_t** data, uint16_t* size);
+
+// Iterates the synced part of each sector from the cursor on, records
+// and their headers, as spans of the XIP window. Used to send a whole
+// log without copying it; the end of a sector may be erased padding.
+bool ring_log_next_span(const ring_log_t* log, ring_log_cursor_t* cursor, const uint8_t** data, uint32_t* size);
+
+void ring_log_get_stats(const ring_log_t* log, ring_log_stats_t* stats);
+
+#endif
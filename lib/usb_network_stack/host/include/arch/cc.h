@@ -0,0 +1,18 @@
+#ifndef ARCH_CC_H
+#define ARCH_CC_H
+
+// lwIP platform hooks for the host build, in place of the pico-sdk port.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LWIP_PLATFORM_DIAG(x) do { printf x; } while (0)
+
+#define LWIP_PLATFORM_ASSERT(x) do { \
+    printf("lwIP assertion \"%s\" failed at %s:%d\n", x, __FILE__, __LINE__); \
+    abort(); \
+} while (0)
+
+#define LWIP_RAND() ((u32_t)rand())
+
+#endif
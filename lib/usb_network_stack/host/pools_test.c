@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/init.h"
+#include "lwip/etharp.h"
+#include "lwip/mem.h"
+#include "lwip/tcp.h"
+#include "lwip/udp.h"
+#include "netif/ethernet.h"
+
+#include "usb_network_pools.h"
+
+// Exhausts the stream, rx and control pools of USB_NETWORK_POOLS one after
+// the other. ARP, DHCP and TCP control traffic must still go out while the
+// stream and rx pools are empty, and network_pool_stats() must report the
+// allocations, high-water marks and failures the test counted. Then control
+// allocations of mixed sizes are made and freed at random, the churn that
+// fragments a heap: an allocation must fail only when its pool and every
+// bigger one are full. Exits with an error on any mismatch.
+//
+//   ./pools_test
+
+#define RX_FRAME_SIZE 1514
+#define MAX_ALLOCS 64
+#define CHURN_STEPS 20000
+
+static struct netif netif;
+static uint32_t frames;
+static int failures;
+
+static ip4_addr_t device_ip, netmask, gateway, host_ip;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures += 1; \
+    } \
+} while (0)
+
+// No timers run, the clock stands still.
+u32_t sys_now(void) {
+    return 0;
+}
+
+// Frames are counted and dropped, the USB side isn't needed.
+static err_t linkoutput_fn(struct netif *netif, struct pbuf *p) {
+    frames += 1;
+    return ERR_OK;
+}
+
+static err_t netif_init_cb(struct netif *netif) {
+    static const uint8_t mac[6] = {0x02, 0x02, 0x84, 0x6A, 0x96, 0x01};
+
+    netif->mtu = 1500;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP;
+    netif->name[0] = 'E';
+    netif->name[1] = 'X';
+    netif->hwaddr_len = sizeof(mac);
+    memcpy(netif->hwaddr, mac, sizeof(mac));
+    netif->linkoutput = linkoutput_fn;
+    netif->output = etharp_output;
+    return ERR_OK;
+}
+
+static network_pool_stats_t pool(const char *name) {
+    network_pool_stats_t stats[8];
+    const int n = network_pool_stats(stats, 8);
+
+    for (int i = 0; i < n; i++) {
+        if (strcmp(stats[i].name, name) == 0) {
+            return stats[i];
+        }
+    }
+
+    printf("No pool named %s\n", name);
+    exit(1);
+}
+
+// Control traffic of the stack: an ARP request, a DHCP-sized reply from the
+// server port and a TCP SYN. Returns true when all three reached the link.
+static bool send_control(struct udp_pcb *dhcp) {
+    const uint32_t before = frames;
+    bool ok = etharp_request(&netif, &host_ip) == ERR_OK;
+
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, 300, PBUF_RAM);
+    ok = ok && p != NULL && udp_sendto(dhcp, p, &host_ip, 68) == ERR_OK;
+    if (p) {
+        pbuf_free(p);
+    }
+
+    struct tcp_pcb *pcb = tcp_new();
+    ok = ok && pcb != NULL && tcp_connect(pcb, &host_ip, 5001, NULL) == ERR_OK;
+    if (pcb) {
+        tcp_abort(pcb);
+    }
+
+    // tcp_abort() sends a RST as well.
+    return ok && frames >= before + 3;
+}
+
+// Control pools, smallest first, and the request sizes that map to each one
+// with room for the header mem_malloc() adds.
+static const char *const churn_names[3] = {"ctrl_128", "ctrl_512", "ctrl_1600"};
+static const mem_size_t churn_min[3] = {1, 129, 513};
+static const mem_size_t churn_max[3] = {100, 480, 1500};
+
+// Every live buffer still holds its fill byte, no other one overlaps it.
+static bool intact(const uint8_t *p, mem_size_t size, uint8_t fill) {
+    for (mem_size_t i = 0; i < size; i++) {
+        if (p[i] != fill) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void fragmentation(void) {
+    static struct {
+        uint8_t *p;
+        mem_size_t size;
+        uint8_t fill;
+    } live[MAX_ALLOCS];
+    int count = 0;
+    uint32_t bigger = 0;
+    uint32_t refused = 0;
+
+    srand(1);
+
+    for (int step = 0; step < CHURN_STEPS; step++) {
+        if (count > 0 && (count == MAX_ALLOCS || rand() % 2)) {
+            const int i = rand() % count;
+            CHECK(intact(live[i].p, live[i].size, live[i].fill));
+            mem_free(live[i].p);
+            live[i] = live[--count];
+            continue;
+        }
+
+        const int size_class = rand() % 3;
+        const mem_size_t size = churn_min[size_class] + rand() % (churn_max[size_class] - churn_min[size_class] + 1);
+
+        // The pool the allocation must land in: the first with room.
+        network_pool_stats_t before[3];
+        int expected = -1;
+        for (int k = 0; k < 3; k++) {
+            before[k] = pool(churn_names[k]);
+            if (expected < 0 && k >= size_class && before[k].used < before[k].avail) {
+                expected = k;
+            }
+        }
+
+        uint8_t *p = mem_malloc(size);
+        if (p == NULL) {
+            CHECK(expected < 0);
+            refused += 1;
+            continue;
+        }
+
+        CHECK(expected >= 0);
+        for (int k = 0; k < 3; k++) {
+            CHECK(pool(churn_names[k]).used == before[k].used + (k == expected));
+        }
+
+        live[count].p = p;
+        live[count].size = size;
+        live[count].fill = step;
+        memset(p, live[count].fill, size);
+        count += 1;
+        bigger += expected > size_class;
+    }
+
+    while (count > 0) {
+        count -= 1;
+        CHECK(intact(live[count].p, live[count].size, live[count].fill));
+        mem_free(live[count].p);
+    }
+
+    for (int k = 0; k < 3; k++) {
+        CHECK(pool(churn_names[k]).used == 0);
+    }
+
+    printf("churn: %d steps, %u in a bigger pool, %u refused\n", CHURN_STEPS, bigger, refused);
+}
+
+int main() {
+    lwip_init();
+    network_pools_init();
+
+    IP4_ADDR(&device_ip, 192, 168, 7, 1);
+    IP4_ADDR(&netmask, 255, 255, 255, 0);
+    IP4_ADDR(&gateway, 0, 0, 0, 0);
+    IP4_ADDR(&host_ip, 192, 168, 7, 2);
+
+    netif_add(&netif, &device_ip, &netmask, &gateway, NULL, netif_init_cb, ethernet_input);
+    netif_set_default(&netif);
+    netif_set_up(&netif);
+    netif_set_link_up(&netif);
+
+    // The host is known, sends don't queue behind an ARP lookup.
+    struct eth_addr host_mac = {{0x02, 0x02, 0x84, 0x6A, 0x96, 0x02}};
+    CHECK(etharp_add_static_entry(&host_ip, &host_mac) == ERR_OK);
+
+    struct udp_pcb *dhcp = udp_new();
+    CHECK(dhcp != NULL && udp_bind(dhcp, IP_ADDR_ANY, 67) == ERR_OK);
+
+    CHECK(send_control(dhcp));
+
+    // Stream pool: every element, then one failure.
+    static struct pbuf *stream[MAX_ALLOCS];
+    network_pool_stats_t before = pool("stream");
+    int streams = 0;
+
+    while (streams < MAX_ALLOCS && (stream[streams] = network_stream_alloc(PBUF_RAW, USB_NETWORK_STREAM_POOL_BUFSIZE))) {
+        streams += 1;
+    }
+
+    network_pool_stats_t after = pool("stream");
+    CHECK(streams == USB_NETWORK_STREAM_POOL_SIZE);
+    CHECK(after.avail == USB_NETWORK_STREAM_POOL_SIZE);
+    CHECK(after.used == (uint32_t)streams);
+    CHECK(after.max == (uint32_t)streams);
+    CHECK(after.err == before.err + 1);
+
+    // The stream pool is empty, the rest of the traffic doesn't notice.
+    CHECK(send_control(dhcp));
+
+    // RX pool: one element per received frame, as tud_network_recv_cb() allocates.
+    static struct pbuf *rx[MAX_ALLOCS];
+    before = pool("rx");
+    int rxs = 0;
+
+    while (rxs < MAX_ALLOCS && (rx[rxs] = pbuf_alloc(PBUF_RAW, RX_FRAME_SIZE, PBUF_POOL))) {
+        rxs += 1;
+    }
+
+    after = pool("rx");
+    CHECK(rxs == USB_NETWORK_RX_POOL_SIZE);
+    CHECK(after.used == (uint32_t)rxs);
+    CHECK(after.max == (uint32_t)rxs);
+    CHECK(after.err == before.err + 1);
+
+    CHECK(send_control(dhcp));
+
+    // Control pools, largest first. A failed allocation also tries every
+    // bigger pool (MEM_USE_POOLS_TRY_BIGGER_POOL), each counts a failure.
+    static void *ctrl[3][MAX_ALLOCS];
+    static const char *const names[3] = {"ctrl_1600", "ctrl_512", "ctrl_128"};
+    static const mem_size_t sizes[3] = {1500, 400, 64};
+    static const int nums[3] = {USB_NETWORK_CTRL_LARGE_NUM, USB_NETWORK_CTRL_MEDIUM_NUM, USB_NETWORK_CTRL_SMALL_NUM};
+    int counts[3] = {0};
+    network_pool_stats_t ctrl_before[3];
+
+    for (int i = 0; i < 3; i++) {
+        ctrl_before[i] = pool(names[i]);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        while (counts[i] < MAX_ALLOCS && (ctrl[i][counts[i]] = mem_malloc(sizes[i]))) {
+            counts[i] += 1;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        after = pool(names[i]);
+        CHECK(counts[i] == nums[i]);
+        CHECK(after.used == (uint32_t)nums[i]);
+        CHECK(after.max == (uint32_t)nums[i]);
+        // ctrl_1600 saw the failures of all three loops, ctrl_128 only its own.
+        CHECK(after.err == ctrl_before[i].err + 3 - i);
+    }
+
+    // Now nothing can be sent, and the failures are counted.
+    const uint32_t err_128 = pool("ctrl_128").err;
+    const uint32_t sent = frames;
+    CHECK(etharp_request(&netif, &host_ip) != ERR_OK);
+    CHECK(frames == sent);
+    CHECK(pool("ctrl_128").err == err_128 + 1);
+
+    // Everything back, the high-water marks stay.
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < counts[i]; j++) {
+            mem_free(ctrl[i][j]);
+        }
+    }
+    for (int i = 0; i < rxs; i++) {
+        pbuf_free(rx[i]);
+    }
+    for (int i = 0; i < streams; i++) {
+        pbuf_free(stream[i]);
+    }
+
+    CHECK(pool("stream").used == 0 && pool("stream").max == (uint32_t)streams);
+    CHECK(pool("rx").used == 0 && pool("rx").max == (uint32_t)rxs);
+    for (int i = 0; i < 3; i++) {
+        CHECK(pool(names[i]).used == 0 && pool(names[i]).max == (uint32_t)nums[i]);
+    }
+
+    CHECK(send_control(dhcp));
+
+    fragmentation();
+
+    // After the churn every element is free again, a full pool of the
+    // largest buffers can still be taken.
+    for (int j = 0; j < USB_NETWORK_CTRL_LARGE_NUM; j++) {
+        ctrl[0][j] = mem_malloc(sizes[0]);
+        CHECK(ctrl[0][j] != NULL);
+    }
+    for (int j = 0; j < USB_NETWORK_CTRL_LARGE_NUM; j++) {
+        mem_free(ctrl[0][j]);
+    }
+
+    CHECK(send_control(dhcp));
+
+    network_pool_stats_t stats[8];
+    const int n = network_pool_stats(stats, 8);
+    for (int i = 0; i < n; i++) {
+        printf("%-10s size %4u avail %3u used %3u max %3u err %3u\n", stats[i].name, stats[i].size,
+               stats[i].avail, stats[i].used, stats[i].max, stats[i].err);
+    }
+
+    printf("%d failures\n", failures);
+
+    return failures ? 1 : 0;
+}
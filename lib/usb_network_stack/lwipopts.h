@@ -48,7 +48,9 @@
 #define LWIP_TCP_KEEPALIVE              1
 
 #define TCP_MSS                         (1500 /*mtu*/ - 20 /*iphdr*/ - 20 /*tcphhr*/)
+#ifndef TCP_SND_BUF
 #define TCP_SND_BUF                     (2 * TCP_MSS)
+#endif
 
 #define ETHARP_SUPPORT_STATIC_ENTRIES   1
 
@@ -58,4 +60,66 @@
 
 #define LWIP_SINGLE_NETIF               1
 
+/* Use the Cortex-M0+ checksum from inet_chksum_m0.c. The generic routine is
+   kept (LWIP_CHKSUM_ALGORITHM) as lwip_standard_chksum() for reference. */
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+uint16_t usb_network_chksum(const void *dataptr, int len);
+#endif
+#define LWIP_CHKSUM                     usb_network_chksum
+#define LWIP_CHKSUM_ALGORITHM           2
+
+/* Static pools for stream payloads, RX frames and control traffic instead of
+   the MEM_SIZE heap (see lwippools.h and usb_network_pools.h). Select per app
+   with target_compile_definitions(<app> PRIVATE USB_NETWORK_POOLS=1). */
+#ifndef USB_NETWORK_POOLS
+#define USB_NETWORK_POOLS               0
+#endif
+
+#if USB_NETWORK_POOLS
+#define MEM_USE_POOLS                   1
+#define MEM_USE_POOLS_TRY_BIGGER_POOL   1
+#define MEMP_USE_CUSTOM_POOLS           1
+#define LWIP_SUPPORT_CUSTOM_PBUF        1
+
+/* Frames received from USB (PBUF_POOL, one full frame per element). */
+#ifndef USB_NETWORK_RX_POOL_SIZE
+#define USB_NETWORK_RX_POOL_SIZE        8
+#endif
+#define PBUF_POOL_SIZE                  USB_NETWORK_RX_POOL_SIZE
+
+/* Stream payloads allocated with network_stream_alloc(). */
+#ifndef USB_NETWORK_STREAM_POOL_SIZE
+#define USB_NETWORK_STREAM_POOL_SIZE    4
+#endif
+#ifndef USB_NETWORK_STREAM_POOL_BUFSIZE
+#define USB_NETWORK_STREAM_POOL_BUFSIZE 1472
+#endif
+
+/* Control traffic: headers, ARP, DHCP, DNS and TCP segments (mem_malloc). */
+#ifndef USB_NETWORK_CTRL_SMALL_NUM
+#define USB_NETWORK_CTRL_SMALL_NUM      16
+#endif
+#ifndef USB_NETWORK_CTRL_MEDIUM_NUM
+#define USB_NETWORK_CTRL_MEDIUM_NUM     8
+#endif
+#ifndef USB_NETWORK_CTRL_LARGE_NUM
+#define USB_NETWORK_CTRL_LARGE_NUM      12
+#endif
+
+/* Needed for the high-water marks reported by network_pool_stats(). The
+   per-protocol counters aren't read, they would only cost RAM and cycles. */
+#define LWIP_STATS                      1
+#define MEM_STATS                       1
+#define MEMP_STATS                      1
+#define LINK_STATS                      0
+#define ETHARP_STATS                    0
+#define IP_STATS                        0
+#define IPFRAG_STATS                    0
+#define ICMP_STATS                      0
+#define UDP_STATS                       0
+#define TCP_STATS                       0
+#define SYS_STATS                       0
+#endif
+
 #endif /* __LWIPOPTS_H__ */
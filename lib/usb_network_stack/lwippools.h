@@ -0,0 +1,10 @@
+/* Custom lwIP memory pools, used when USB_NETWORK_POOLS is set.
+   This file is included several times by memp_std.h, it has no include guard. */
+
+#if MEM_USE_POOLS
+LWIP_MALLOC_MEMPOOL_START
+LWIP_MALLOC_MEMPOOL(USB_NETWORK_CTRL_SMALL_NUM,  128)
+LWIP_MALLOC_MEMPOOL(USB_NETWORK_CTRL_MEDIUM_NUM, 512)
+LWIP_MALLOC_MEMPOOL(USB_NETWORK_CTRL_LARGE_NUM,  1600)
+LWIP_MALLOC_MEMPOOL_END
+#endif
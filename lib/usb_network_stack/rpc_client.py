@@ -0,0 +1,67 @@
+import socket
+import struct
+
+# Host client for the binary RPC server in usb_network_rpc.h.
+#
+#   rpc = RpcClient("192.168.7.1")
+#   rpc.call(0, b"hello")  # ping
+
+MAGIC = 0x5052
+HEADER = struct.Struct("<HBBHH")
+
+STATUS = {
+    1: "no handler for this method",
+    2: "invalid arguments",
+    3: "reply too long",
+}
+
+
+class RpcError(Exception):
+    pass
+
+
+class RpcClient:
+    def __init__(self, host="192.168.7.1", port=7780, timeout=2.0):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.seq = 0
+
+    def _recv_exact(self, size):
+        data = b""
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise RpcError("connection closed")
+            data += chunk
+        return data
+
+    def call(self, method, payload=b""):
+        self.seq = (self.seq + 1) & 0xFFFF
+        self.sock.sendall(HEADER.pack(MAGIC, method, 0, self.seq, len(payload)) + payload)
+
+        magic, r_method, status, seq, length = HEADER.unpack(self._recv_exact(HEADER.size))
+        if magic != MAGIC or r_method != method or seq != self.seq:
+            raise RpcError("out of sync")
+
+        reply = self._recv_exact(length)
+        if status != 0:
+            raise RpcError(STATUS.get(status, f"status {status}"))
+
+        return reply
+
+    def close(self):
+        self.sock.close()
+
+
+if __name__ == "__main__":
+    import sys
+    import time
+
+    rpc = RpcClient(*sys.argv[1:2])
+
+    start = time.perf_counter()
+    for _ in range(100):
+        rpc.call(0, b"ping")
+    elapsed = time.perf_counter() - start
+
+    print(f"Round trip: {elapsed * 10:.3f} ms")
@@ -25,8 +25,13 @@
  *
  */
 
+#ifndef USB_NETWORK_H
+#define USB_NETWORK_H
+
 #include "bsp/board.h"
 #include "tusb.h"
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
 
 #include "dhserver.h"
 #include "dnserver.h"
@@ -34,6 +39,8 @@
 #include "lwip/timeouts.h"
 #include "httpd.h"
 
+#include "usb_network_pools.h"
+
 /* lwip context */
 static struct netif netif_data;
 
@@ -189,6 +196,7 @@ void network_init() {
     board_init();
     tusb_init();
     init_lwip();
+    network_pools_init();
     
     // Startup lwIP stack.
     while (!netif_is_up(&netif_data));
@@ -196,7 +204,104 @@ void network_init() {
     while (dnserv_init(&ipaddr, 53, dns_query_proc) != ERR_OK);
 }
 
+/* longest sleep in network_wait(), in case a wake-up is ever missed */
+#ifndef NETWORK_MAX_SLEEP_MS
+#define NETWORK_MAX_SLEEP_MS 100
+#endif
+
+#ifndef NETWORK_MAX_WAKE_SOURCES
+#define NETWORK_MAX_WAKE_SOURCES 4
+#endif
+
+/* returns true when the app has work and the loop must not sleep */
+typedef bool (*network_wake_source_t)(void *arg);
+
+typedef struct {
+    uint32_t sleeps;            /* calls to network_wait() that slept */
+    uint64_t sleep_us;          /* total time spent asleep */
+    uint32_t wakes;             /* network_wake() calls serviced */
+    uint64_t wake_latency_us;   /* total time from network_wake() to network_step() */
+    uint32_t wake_latency_max_us;
+} network_event_stats_t;
+
+static struct {
+    network_wake_source_t fn[NETWORK_MAX_WAKE_SOURCES];
+    void *arg[NETWORK_MAX_WAKE_SOURCES];
+    uint count;
+    volatile bool pending;
+    volatile uint32_t wake_time;
+    network_event_stats_t stats;
+} network_event;
+
+/* register a condition checked before the loop goes to sleep */
+bool network_add_wake_source(network_wake_source_t fn, void *arg) {
+    if (network_event.count >= NETWORK_MAX_WAKE_SOURCES) {
+        return false;
+    }
+
+    network_event.fn[network_event.count] = fn;
+    network_event.arg[network_event.count] = arg;
+    network_event.count += 1;
+
+    return true;
+}
+
+/* signal that there is work for the loop; safe from interrupts and from the other core */
+void network_wake() {
+    if (!network_event.pending) {
+        network_event.wake_time = time_us_32();
+        network_event.pending = true;
+    }
+    __sev();
+}
+
+void network_get_event_stats(network_event_stats_t *stats) {
+    *stats = network_event.stats;
+}
+
 void network_step() {
+    if (network_event.pending) {
+        network_event.pending = false;
+
+        const uint32_t latency = time_us_32() - network_event.wake_time;
+        network_event.stats.wakes += 1;
+        network_event.stats.wake_latency_us += latency;
+        if (latency > network_event.stats.wake_latency_max_us) {
+            network_event.stats.wake_latency_max_us = latency;
+        }
+    }
+
     tud_task();
     service_traffic();
-}
\ No newline at end of file
+}
+
+/* sleep until an interrupt, an lwIP timer deadline, a wake source or network_wake() */
+void network_wait() {
+    if (network_event.pending || received_frame) {
+        return;
+    }
+
+    for (uint i = 0; i < network_event.count; i++) {
+        if (network_event.fn[i](network_event.arg[i])) {
+            return;
+        }
+    }
+
+    uint32_t sleep_ms = sys_timeouts_sleeptime();
+    if (sleep_ms == 0) {
+        return;
+    }
+    if (sleep_ms > NETWORK_MAX_SLEEP_MS) {
+        sleep_ms = NETWORK_MAX_SLEEP_MS;
+    }
+
+    /* any interrupt taken since the last check (USB, DMA, timers) sets the
+       event register, so __wfe() returns right away instead of missing it */
+    const uint32_t start = time_us_32();
+    best_effort_wfe_or_timeout(make_timeout_time_ms(sleep_ms));
+
+    network_event.stats.sleeps += 1;
+    network_event.stats.sleep_us += time_us_32() - start;
+}
+
+#endif
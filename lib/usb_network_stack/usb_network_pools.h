@@ -0,0 +1,99 @@
+#ifndef USB_NETWORK_POOLS_H
+#define USB_NETWORK_POOLS_H
+
+#include "lwip/pbuf.h"
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+
+/* Usage statistics of a memory pool, counts are in elements. */
+typedef struct {
+    const char* name;
+    uint32_t size;  /* bytes per element, 0 for the heap (counts in bytes) */
+    uint32_t avail;
+    uint32_t used;
+    uint32_t max;   /* high-water mark */
+    uint32_t err;   /* failed allocations */
+} network_pool_stats_t;
+
+#if USB_NETWORK_POOLS
+
+/* stream payloads live in their own pool so a burst can't starve control traffic */
+typedef struct {
+    struct pbuf_custom pc;
+    uint8_t data[PBUF_LINK_HLEN + PBUF_IP_HLEN + PBUF_TRANSPORT_HLEN + USB_NETWORK_STREAM_POOL_BUFSIZE];
+} network_stream_buf_t;
+
+LWIP_MEMPOOL_DECLARE(STREAM, USB_NETWORK_STREAM_POOL_SIZE, sizeof(network_stream_buf_t), "STREAM");
+
+static void network_stream_free(struct pbuf *p) {
+    LWIP_MEMPOOL_FREE(STREAM, p);
+}
+
+static void network_pools_init(void) {
+    LWIP_MEMPOOL_INIT(STREAM);
+}
+
+/* allocate a stream payload; the layer reserves header room like pbuf_alloc() */
+struct pbuf* network_stream_alloc(pbuf_layer layer, u16_t length) {
+    network_stream_buf_t *buf = (network_stream_buf_t *)LWIP_MEMPOOL_ALLOC(STREAM);
+
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    buf->pc.custom_free_function = network_stream_free;
+
+    struct pbuf *p = pbuf_alloced_custom(layer, length, PBUF_RAM, &buf->pc,
+                                         buf->data, sizeof(buf->data));
+    if (p == NULL) {
+        LWIP_MEMPOOL_FREE(STREAM, buf);
+    }
+
+    return p;
+}
+
+#else
+
+static void network_pools_init(void) {}
+
+/* without USB_NETWORK_POOLS the stream payloads come from the heap */
+struct pbuf* network_stream_alloc(pbuf_layer layer, u16_t length) {
+    return pbuf_alloc(layer, length, PBUF_RAM);
+}
+
+#endif
+
+static void network_pool_fill(network_pool_stats_t *s, const char *name,
+                              uint32_t size, const struct stats_mem *stats) {
+    s->name = name;
+    s->size = size;
+    s->avail = stats->avail;
+    s->used = stats->used;
+    s->max = stats->max;
+    s->err = stats->err;
+}
+
+/* fill up to count entries with the pool statistics; returns the number of entries */
+int network_pool_stats(network_pool_stats_t *out, int count) {
+    int n = 0;
+
+#define NETWORK_POOL_STAT(name, desc) \
+    if (n < count) network_pool_fill(&out[n++], name, (desc)->size, (desc)->stats)
+
+    NETWORK_POOL_STAT("rx", memp_pools[MEMP_PBUF_POOL]);
+
+#if USB_NETWORK_POOLS
+    NETWORK_POOL_STAT("stream", &memp_STREAM);
+    NETWORK_POOL_STAT("ctrl_128", memp_pools[MEMP_POOL128]);
+    NETWORK_POOL_STAT("ctrl_512", memp_pools[MEMP_POOL512]);
+    NETWORK_POOL_STAT("ctrl_1600", memp_pools[MEMP_POOL1600]);
+#else
+    if (n < count) network_pool_fill(&out[n++], "heap", 0, &lwip_stats.mem);
+#endif
+
+#undef NETWORK_POOL_STAT
+
+    return n;
+}
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef USB_NETWORK_RPC_H
+#define USB_NETWORK_RPC_H
+
+#include <string.h>
+
+#include "lwip/tcp.h"
+
+/* Minimal binary request/response server on a single TCP port.
+   Every message is a fixed 8-byte header followed by up to
+   NETWORK_RPC_MAX_PAYLOAD bytes. All fields are little-endian. */
+
+#ifndef NETWORK_RPC_PORT
+#define NETWORK_RPC_PORT 7780
+#endif
+
+#ifndef NETWORK_RPC_MAX_HANDLERS
+#define NETWORK_RPC_MAX_HANDLERS 16
+#endif
+
+#ifndef NETWORK_RPC_MAX_CLIENTS
+#define NETWORK_RPC_MAX_CLIENTS 2
+#endif
+
+#ifndef NETWORK_RPC_MAX_PAYLOAD
+#define NETWORK_RPC_MAX_PAYLOAD 256
+#endif
+
+#define NETWORK_RPC_MAGIC 0x5052 /* "RP" */
+
+/* method 0 is built in and echoes the request payload */
+#define NETWORK_RPC_METHOD_PING 0
+
+typedef enum {
+    NETWORK_RPC_OK = 0,
+    NETWORK_RPC_ERR_METHOD = 1,   /* no handler for this method */
+    NETWORK_RPC_ERR_ARGS = 2,     /* the handler rejected the payload */
+    NETWORK_RPC_ERR_TOO_LONG = 3, /* the reply doesn't fit in the send buffer */
+} network_rpc_status_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t method;
+    uint8_t status;   /* 0 in requests, network_rpc_status_t in replies */
+    uint16_t seq;     /* echoed in the reply */
+    uint16_t len;     /* payload bytes after the header */
+} network_rpc_header_t;
+
+/* By default the reply is sent straight from data without a copy, so it must
+   stay valid and unchanged until acknowledged (static or const buffers).
+   Set copy for data that changes, like a telemetry snapshot. */
+typedef struct {
+    const void *data;
+    uint16_t len;
+    bool copy;
+} network_rpc_reply_t;
+
+typedef uint8_t (*network_rpc_handler_t)(const uint8_t *args, uint16_t len,
+                                         network_rpc_reply_t *reply, void *arg);
+
+typedef struct {
+    struct tcp_pcb *pcb;
+    struct pbuf *rx_queue;      /* received but not yet parsed */
+    uint8_t rx[sizeof(network_rpc_header_t) + NETWORK_RPC_MAX_PAYLOAD];
+    uint16_t rx_len;
+    bool reply_pending;         /* handler ran, waiting for send buffer */
+    bool reply_header_queued;   /* header written, the payload still waits */
+    network_rpc_header_t reply_header;
+    network_rpc_reply_t reply;
+} network_rpc_conn_t;
+
+static struct {
+    network_rpc_handler_t handler[NETWORK_RPC_MAX_HANDLERS];
+    void *arg[NETWORK_RPC_MAX_HANDLERS];
+    network_rpc_conn_t conn[NETWORK_RPC_MAX_CLIENTS];
+    uint32_t requests;
+} network_rpc;
+
+static uint8_t network_rpc_ping(const uint8_t *args, uint16_t len,
+                                network_rpc_reply_t *reply, void *arg) {
+    reply->data = args;
+    reply->len = len;
+    reply->copy = true;
+    return NETWORK_RPC_OK;
+}
+
+/* returns true when the pcb had to be aborted, lwIP callbacks must then return ERR_ABRT */
+static bool network_rpc_close(network_rpc_conn_t *conn) {
+    bool aborted = false;
+
+    if (conn->rx_queue) {
+        pbuf_free(conn->rx_queue);
+        conn->rx_queue = NULL;
+    }
+
+    if (conn->pcb) {
+        tcp_arg(conn->pcb, NULL);
+        tcp_recv(conn->pcb, NULL);
+        tcp_sent(conn->pcb, NULL);
+        tcp_err(conn->pcb, NULL);
+        tcp_poll(conn->pcb, NULL, 0);
+        if (tcp_close(conn->pcb) != ERR_OK) {
+            tcp_abort(conn->pcb);
+            aborted = true;
+        }
+        conn->pcb = NULL;
+    }
+
+    return aborted;
+}
+
+/* writes the reply once header and payload fit; a tcp_write() can still fail
+ * on segment or pbuf memory, then the reply stays pending and is retried from
+ * the sent and poll callbacks. A header already queued is never written twice,
+ * the client would lose the framing. */
+static bool network_rpc_send_reply(network_rpc_conn_t *conn) {
+    struct tcp_pcb *pcb = conn->pcb;
+    const uint16_t len = conn->reply.len;
+    const uint16_t header = conn->reply_header_queued ? 0 : sizeof(network_rpc_header_t);
+
+    if (tcp_sndbuf(pcb) < header + len ||
+        tcp_sndqueuelen(pcb) + 2 > TCP_SND_QUEUELEN) {
+        return false;
+    }
+
+    /* the header is small and per-connection, it is always copied */
+    if (header) {
+        if (tcp_write(pcb, &conn->reply_header, header,
+                      TCP_WRITE_FLAG_COPY | (len ? TCP_WRITE_FLAG_MORE : 0)) != ERR_OK) {
+            return false;
+        }
+        conn->reply_header_queued = true;
+    }
+
+    if (len && tcp_write(pcb, conn->reply.data, len, conn->reply.copy ? TCP_WRITE_FLAG_COPY : 0) != ERR_OK) {
+        return false;
+    }
+
+    tcp_output(pcb);
+    conn->reply_pending = false;
+    conn->reply_header_queued = false;
+
+    return true;
+}
+
+static void network_rpc_dispatch(network_rpc_conn_t *conn) {
+    const network_rpc_header_t *req = (const network_rpc_header_t *)conn->rx;
+    const uint8_t *args = conn->rx + sizeof(network_rpc_header_t);
+    network_rpc_handler_t handler = (req->method < NETWORK_RPC_MAX_HANDLERS) ?
+                                        network_rpc.handler[req->method] : NULL;
+
+    conn->reply = (network_rpc_reply_t){ NULL, 0, false };
+
+    uint8_t status = NETWORK_RPC_ERR_METHOD;
+    if (handler) {
+        status = handler(args, req->len, &conn->reply, network_rpc.arg[req->method]);
+    }
+
+    if (status != NETWORK_RPC_OK) {
+        conn->reply.len = 0;
+    }
+
+    if (sizeof(network_rpc_header_t) + conn->reply.len > TCP_SND_BUF) {
+        status = NETWORK_RPC_ERR_TOO_LONG;
+        conn->reply.len = 0;
+    }
+
+    conn->reply_header.magic = NETWORK_RPC_MAGIC;
+    conn->reply_header.method = req->method;
+    conn->reply_header.status = status;
+    conn->reply_header.seq = req->seq;
+    conn->reply_header.len = conn->reply.len;
+    conn->reply_pending = true;
+    conn->reply_header_queued = false;
+
+    network_rpc.requests += 1;
+}
+
+/* parse queued bytes and answer complete requests while the send buffer allows;
+ * returns true when the pcb was aborted */
+static bool network_rpc_process(network_rpc_conn_t *conn) {
+    const uint16_t header_size = sizeof(network_rpc_header_t);
+    const network_rpc_header_t *req = (const network_rpc_header_t *)conn->rx;
+
+    while (true) {
+        if (conn->reply_pending && !network_rpc_send_reply(conn)) {
+            return false;
+        }
+
+        if (conn->rx_len >= header_size && conn->rx_len == header_size + req->len) {
+            network_rpc_dispatch(conn);
+            tcp_recved(conn->pcb, conn->rx_len);
+            conn->rx_len = 0;
+            continue;
+        }
+
+        if (conn->rx_queue == NULL) {
+            return false;
+        }
+
+        uint16_t need = (conn->rx_len < header_size) ?
+                            header_size - conn->rx_len :
+                            header_size + req->len - conn->rx_len;
+
+        uint16_t n = pbuf_copy_partial(conn->rx_queue, conn->rx + conn->rx_len, need, 0);
+        conn->rx_len += n;
+        conn->rx_queue = pbuf_free_header(conn->rx_queue, n);
+
+        if (conn->rx_len == header_size &&
+            (req->magic != NETWORK_RPC_MAGIC || req->len > NETWORK_RPC_MAX_PAYLOAD)) {
+            /* out of sync, there is no way to find the next header */
+            return network_rpc_close(conn);
+        }
+    }
+}
+
+static err_t network_rpc_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    network_rpc_conn_t *conn = (network_rpc_conn_t *)arg;
+
+    if (p == NULL) {
+        return network_rpc_close(conn) ? ERR_ABRT : ERR_OK;
+    }
+
+    if (err != ERR_OK) {
+        pbuf_free(p);
+        return err;
+    }
+
+    if (conn->rx_queue) {
+        pbuf_cat(conn->rx_queue, p);
+    } else {
+        conn->rx_queue = p;
+    }
+
+    return network_rpc_process(conn) ? ERR_ABRT : ERR_OK;
+}
+
+static err_t network_rpc_sent(void *arg, struct tcp_pcb *pcb, u16_t len) {
+    return network_rpc_process((network_rpc_conn_t *)arg) ? ERR_ABRT : ERR_OK;
+}
+
+/* nothing may be in flight when a write failed, no sent callback would come */
+static err_t network_rpc_poll(void *arg, struct tcp_pcb *pcb) {
+    return network_rpc_process((network_rpc_conn_t *)arg) ? ERR_ABRT : ERR_OK;
+}
+
+static void network_rpc_err(void *arg, err_t err) {
+    network_rpc_conn_t *conn = (network_rpc_conn_t *)arg;
+
+    /* the pcb is already freed by lwIP */
+    conn->pcb = NULL;
+    network_rpc_close(conn);
+}
+
+static err_t network_rpc_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    if (err != ERR_OK || pcb == NULL) {
+        return ERR_VAL;
+    }
+
+    for (int i = 0; i < NETWORK_RPC_MAX_CLIENTS; i++) {
+        network_rpc_conn_t *conn = &network_rpc.conn[i];
+
+        if (conn->pcb == NULL) {
+            conn->pcb = pcb;
+            conn->rx_queue = NULL;
+            conn->rx_len = 0;
+            conn->reply_pending = false;
+            conn->reply_header_queued = false;
+
+            tcp_arg(pcb, conn);
+            tcp_recv(pcb, network_rpc_recv);
+            tcp_sent(pcb, network_rpc_sent);
+            tcp_err(pcb, network_rpc_err);
+            tcp_poll(pcb, network_rpc_poll, 2);
+            tcp_nagle_disable(pcb);
+
+            return ERR_OK;
+        }
+    }
+
+    tcp_abort(pcb);
+    return ERR_ABRT;
+}
+
+/* register a handler for a method id; replaces any previous handler */
+bool network_rpc_register(uint8_t method, network_rpc_handler_t handler, void *arg) {
+    if (method >= NETWORK_RPC_MAX_HANDLERS) {
+        return false;
+    }
+
+    network_rpc.handler[method] = handler;
+    network_rpc.arg[method] = arg;
+
+    return true;
+}
+
+/* start listening on NETWORK_RPC_PORT; call after network_init() */
+bool network_rpc_init() {
+    struct tcp_pcb *pcb = tcp_new();
+
+    if (pcb == NULL || tcp_bind(pcb, IP_ADDR_ANY, NETWORK_RPC_PORT) != ERR_OK) {
+        return false;
+    }
+
+    struct tcp_pcb *listen = tcp_listen(pcb);
+    if (listen == NULL) {
+        return false;
+    }
+
+    tcp_accept(listen, network_rpc_accept);
+    network_rpc_register(NETWORK_RPC_METHOD_PING, network_rpc_ping, NULL);
+
+    return true;
+}
+
+#endif